@@ -0,0 +1,37 @@
+(* BDB inserts and range scans on (int64 * string) keys, comparing in OCaml vs in C *)
+
+open Tokyo_cabinet
+
+let nkeys = 200000
+
+let key i = (Int64.of_int ((i * 7919) mod nkeys), "key" ^ string_of_int (i mod 100))
+
+(* same encoding, but without declaring it, so Otoky_bdb installs an OCaml comparator *)
+let opaque t =
+  Otoky_type.make
+    ~type_desc:t.Otoky_type.type_desc
+    ~marshall:t.Otoky_type.marshall
+    ~unmarshall:t.Otoky_type.unmarshall
+    ~compare:t.Otoky_type.compare
+    ()
+
+let bench name ktype =
+  let fn = Filename.temp_file "bench" ".tcb" in
+  let bdb = Otoky_bdb.open_ ~omode:[Owriter; Ocreat; Otrunc] ktype Otoky_type.int fn in
+  let t0 = Unix.gettimeofday () in
+  for i = 0 to nkeys - 1 do Otoky_bdb.put bdb (key i) i done;
+  let t1 = Unix.gettimeofday () in
+  let n = ref 0 in
+  for i = 0 to 999 do
+    let bkey = (Int64.of_int (i * 100), "") in
+    n := !n + List.length (Otoky_bdb.range bdb ~bkey ~max:100 ())
+  done;
+  let t2 = Unix.gettimeofday () in
+  Printf.printf "%-8s put %8.3fs range %8.3fs (%d keys)\n%!" name (t1 -. t0) (t2 -. t1) !n;
+  Otoky_bdb.close bdb;
+  Unix.unlink fn
+
+let () =
+  let ktype = Otoky_type.tuple2 Otoky_type.int64 Otoky_type.string in
+  bench "ocaml" (opaque ktype);
+  bench "c" ktype
@@ -0,0 +1,43 @@
+(* compare get (raising Enorec on a miss) with find on a 90%-miss workload *)
+
+open Tokyo_cabinet
+
+let nkeys = 100000
+let nlookups = 1000000
+
+let key i = "key" ^ string_of_int i
+
+let bench name lookup keys =
+  Gc.compact ();
+  let words () = let s = Gc.quick_stat () in s.Gc.minor_words +. s.Gc.major_words -. s.Gc.promoted_words in
+  let w0 = words () in
+  let t0 = Unix.gettimeofday () in
+  let hits = ref 0 in
+  Array.iter (fun k -> if lookup k then incr hits) keys;
+  let t1 = Unix.gettimeofday () in
+  let w1 = words () in
+  Printf.printf "%-10s %8.3fs %8.1f words/lookup %d hits\n%!"
+    name (t1 -. t0) ((w1 -. w0) /. float_of_int (Array.length keys)) !hits
+
+let run name get find =
+  (* 1 in 10 lookups hits *)
+  let keys = Array.init nlookups (fun i -> key ((i * 7919) mod (10 * nkeys))) in
+  bench (name ^ ".get") (fun k -> try ignore (get k); true with Error (Enorec, _, _) -> false) keys;
+  bench (name ^ ".find") (fun k -> match find k with Some _ -> true | None -> false) keys
+
+let () =
+  let fn = Filename.temp_file "bench" ".tch" in
+  let hdb = HDB.new_ () in
+  HDB.open_ hdb ~omode:[Owriter; Ocreat; Otrunc] fn;
+  for i = 0 to nkeys - 1 do HDB.put hdb (key i) (string_of_int i) done;
+  run "hdb" (HDB.get hdb) (HDB.find hdb);
+  HDB.close hdb;
+  Unix.unlink fn;
+
+  let fn = Filename.temp_file "bench" ".tcb" in
+  let bdb = BDB.new_ () in
+  BDB.open_ bdb ~omode:[Owriter; Ocreat; Otrunc] fn;
+  for i = 0 to nkeys - 1 do BDB.put bdb (key i) (string_of_int i) done;
+  run "bdb" (BDB.get bdb) (BDB.find bdb);
+  BDB.close bdb;
+  Unix.unlink fn
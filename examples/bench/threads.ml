@@ -0,0 +1,41 @@
+(* random HDB/BDB reads from 1, 2, 4 and 8 threads sharing one handle *)
+
+open Tokyo_cabinet
+
+let nkeys = 100000
+let nlookups = 400000
+
+let key i = "key" ^ string_of_int i
+
+let bench name get nthreads =
+  let per_thread = nlookups / nthreads in
+  let reader n () =
+    for i = 0 to per_thread - 1 do
+      ignore (get (key (((n * per_thread + i) * 7919) mod nkeys)))
+    done in
+  let t0 = Unix.gettimeofday () in
+  let threads = Array.init nthreads (fun n -> Thread.create (reader n) ()) in
+  Array.iter Thread.join threads;
+  let t = Unix.gettimeofday () -. t0 in
+  Printf.printf "%s %d threads: %8.3fs %10.0f lookups/s\n%!"
+    name nthreads t (float_of_int (per_thread * nthreads) /. t)
+
+let run name get =
+  List.iter (bench name get) [ 1; 2; 4; 8 ]
+
+let () =
+  let fn = Filename.temp_file "bench" ".tch" in
+  let hdb = HDB.new_ () in
+  HDB.open_ hdb ~omode:[Owriter; Ocreat; Otrunc] fn;
+  for i = 0 to nkeys - 1 do HDB.put hdb (key i) (string_of_int i) done;
+  run "hdb" (HDB.get hdb);
+  HDB.close hdb;
+  Unix.unlink fn;
+
+  let fn = Filename.temp_file "bench" ".tcb" in
+  let bdb = BDB.new_ () in
+  BDB.open_ bdb ~omode:[Owriter; Ocreat; Otrunc] fn;
+  for i = 0 to nkeys - 1 do BDB.put bdb (key i) (string_of_int i) done;
+  run "bdb" (BDB.get bdb);
+  BDB.close bdb;
+  Unix.unlink fn
@@ -13,13 +13,13 @@ let ktype =
   let type_desc = type_desc_k in
   let marshall = Otoky_bin_prot.marshall bin_k in
   let unmarshall = Otoky_bin_prot.unmarshall bin_k in
-  Otoky_type.make ~type_desc ~marshall ~unmarshall ~compare
+  Otoky_type.make ~type_desc ~marshall ~unmarshall ~compare ()
 
 let vtype =
   let type_desc = type_desc_v in
   let marshall = Otoky_bin_prot.marshall bin_v in
   let unmarshall = Otoky_bin_prot.unmarshall bin_v in
-  Otoky_type.make ~type_desc ~marshall ~unmarshall ~compare
+  Otoky_type.make ~type_desc ~marshall ~unmarshall ~compare ()
 
 let example () =
   let fn = Filename.temp_file "foo" "bar" in
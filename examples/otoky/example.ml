@@ -14,13 +14,13 @@ let ktype =
   let type_desc = type_desc_k in
   let marshall { foo = foo } = (foo, String.length foo) in
   let unmarshall cstr = { foo = Cstr.copy cstr } in
-  Otoky_type.make ~type_desc ~marshall ~unmarshall ~compare
+  Otoky_type.make ~type_desc ~marshall ~unmarshall ~compare ()
 
 let vtype =
   let type_desc = type_desc_v in
   let marshall { bar = bar } = (bar, String.length bar) in
   let unmarshall cstr = { bar = Cstr.copy cstr } in
-  Otoky_type.make ~type_desc ~marshall ~unmarshall ~compare
+  Otoky_type.make ~type_desc ~marshall ~unmarshall ~compare ()
 
 let example () =
   let fn = Filename.temp_file "foo" "bar" in
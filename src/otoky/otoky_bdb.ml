@@ -5,32 +5,48 @@ module Type =
 struct
   include Otoky_type
 
-  let type_desc_hash_key = "__otoky_type_desc_hash__"
+  (* where the type_desc hash was kept before it moved to the opaque header *)
+  let legacy_hash_key = "__otoky_type_desc_hash__"
 
-  let is_type_desc_hash_key k klen =
-    (* argh. maybe we should store the type_desc hash somewhere else. but where? *)
-    if klen <> String.length type_desc_hash_key
+  let is_legacy_hash_key k klen =
+    if klen <> String.length legacy_hash_key
     then false
     else
       let rec loop i =
         if i = klen then true
-        else if String.unsafe_get k i <> String.unsafe_get type_desc_hash_key i then false
+        else if String.unsafe_get k i <> String.unsafe_get legacy_hash_key i then false
         else loop (i + 1) in
       loop 0
 
-  let marshall_key t k func =
-    let (k, klen) as mk = t.marshall k in
-    if is_type_desc_hash_key k klen
-    then raise (Error (Einvalid, func, "marshalled value is type_desc_hash key"))
-    else mk
-
   let compare_cstr t a alen b blen =
-    match is_type_desc_hash_key a alen, is_type_desc_hash_key b blen with
+    t.compare (t.unmarshall (a, alen)) (t.unmarshall (b, blen))
+
+  let cmpfield = function
+    | F_int32 -> BDB.Cf_int32
+    | F_int64 -> BDB.Cf_int64
+    | F_string -> BDB.Cf_string
+
+  let cmpfunc t =
+    match t.encoding with
+      | Some fields -> BDB.Cmp_fields (List.map cmpfield fields)
+      | None -> BDB.Cmp_custom_cstr (compare_cstr t)
+
+  (* the comparator for files that still hold the legacy hash key, which sorts first *)
+  let legacy_compare_cstr t a alen b blen =
+    match is_legacy_hash_key a alen, is_legacy_hash_key b blen with
       | true, true -> 0
       | true, false -> -1
       | false, true -> 1
       | _ -> t.compare (t.unmarshall (a, alen)) (t.unmarshall (b, blen))
 
+  let legacy_cmpfunc t =
+    match t.encoding with
+      | Some fields
+          (* the C comparator sorts keys it can't decode first *)
+          when not (decodes fields (legacy_hash_key, String.length legacy_hash_key)) ->
+          BDB.Cmp_fields (List.map cmpfield fields)
+      | _ -> BDB.Cmp_custom_cstr (legacy_compare_cstr t)
+
   let unmarshall_tclist t tclist =
     try
       let num = Tclist.num tclist in
@@ -40,11 +56,8 @@ struct
         then []
         else
           let v = Tclist.val_ tclist k len in
-          if is_type_desc_hash_key v !len (* XXX could make this a flag *)
-          then loop (k + 1)
-          else
-            let v = t.unmarshall (v, !len) in
-            v :: loop (k + 1) in
+          let v = t.unmarshall (v, !len) in
+          v :: loop (k + 1) in
       let r = loop 0 in
       Tclist.del tclist;
       r
@@ -73,13 +86,10 @@ struct
     vtype : 'v Type.t;
   }
 
-  let first t =
-    (* first key should always be type_desc hash key *)
-    BDBCUR.first t.bdbcur;
-    BDBCUR.next t.bdbcur
+  let first t = BDBCUR.first t.bdbcur
 
   let jump t k =
-    BDBCUR_raw.jump t.bdbcur (Type.marshall_key t.ktype k "jump")
+    Type.with_marshalled t.ktype k (BDBCUR_raw.jump t.bdbcur)
 
   let key t =
     let cstr = BDBCUR_raw.key t.bdbcur in
@@ -91,17 +101,35 @@ struct
 
   let last t = BDBCUR.last t.bdbcur
   let next t = BDBCUR.next t.bdbcur
+
+  let unmarshall_pairs t cstrs =
+    let len = Array.length cstrs in
+    let del_from i =
+      for j = i to len - 1 do
+        let (kcstr, vcstr) = cstrs.(j) in
+        Cstr.del kcstr;
+        Cstr.del vcstr
+      done in
+    let rec loop i l =
+      if i = len then Array.of_list (List.rev l)
+      else
+        let (kcstr, vcstr) = cstrs.(i) in
+        let kv =
+          try
+            let kv = (t.ktype.Type.unmarshall kcstr, t.vtype.Type.unmarshall vcstr) in
+            Cstr.del kcstr;
+            Cstr.del vcstr;
+            kv
+          with e -> del_from i; raise e in
+        loop (i + 1) (kv :: l) in
+    loop 0 []
+
+  let next_n t num = unmarshall_pairs t (BDBCUR_raw.next_n t.bdbcur num)
   let out t = BDBCUR.out t.bdbcur
 
-  let prev t =
-    (* check to see if we've moved onto the type_desc hash key *)
-    BDBCUR.prev t.bdbcur;
-    let (k, klen) as cstr = BDBCUR_raw.key t.bdbcur in
-    try
-      if Type.is_type_desc_hash_key k klen
-      then BDBCUR.prev t.bdbcur;
-      Cstr.del cstr
-    with e -> Cstr.del cstr; raise e
+  let prev t = BDBCUR.prev t.bdbcur
+
+  let prev_n t num = unmarshall_pairs t (BDBCUR_raw.prev_n t.bdbcur num)
 
   let put t ?cpmode v = BDBCUR_raw.put t.bdbcur ?cpmode (t.vtype.Type.marshall v)
 
@@ -114,6 +142,23 @@ struct
     with e -> Cstr.del cstr; raise e
 end
 
+module Write_batch =
+struct
+  module WB_raw = Write_batch.Fun (Cstr_cstr)
+
+  type ('k, 'v) t = {
+    wb : Write_batch.t;
+    ktype : 'k Type.t;
+    vtype : 'v Type.t;
+  }
+
+  let clear t = Write_batch.clear t.wb
+  let num t = Write_batch.num t.wb
+  let out t k = Type.with_marshalled t.ktype k (WB_raw.out t.wb)
+  let put t k v = Type.with_marshalled t.ktype k (fun k -> WB_raw.put t.wb k (t.vtype.Type.marshall v))
+  let putkeep t k v = Type.with_marshalled t.ktype k (fun k -> WB_raw.putkeep t.wb k (t.vtype.Type.marshall v))
+end
+
 module BDB_raw = BDB.Fun (Cstr_cstr) (Tclist_tclist)
 
 type ('k, 'v) t = {
@@ -123,32 +168,94 @@ type ('k, 'v) t = {
 }
 
 let open_ ?omode ktype vtype fn =
-  let bdb = BDB.new_ () in
-  BDB.setcmpfunc bdb (BDB.Cmp_custom_cstr (Type.compare_cstr ktype));
-  BDB.open_ bdb ?omode fn;
+  let open_with cmpfunc =
+    let bdb = BDB.new_ () in
+    BDB.setcmpfunc bdb cmpfunc;
+    BDB.open_ bdb ?omode fn;
+    bdb in
   let hash = Type.type_desc_hash ktype ^ Type.type_desc_hash vtype in
-  begin try
-    if hash <> BDB.get bdb Type.type_desc_hash_key
-    then begin
-      BDB.close bdb;
-      raise (Error (Einvalid, "open_", "bad type_desc hash"))
-    end
-  with Error (Enorec, _, _) ->
-    (* XXX maybe should check that this is a fresh db? *)
-    BDB.put bdb Type.type_desc_hash_key hash;
-  end;
+  let fail bdb msg =
+    BDB.close bdb;
+    raise (Error (Einvalid, "open_", msg)) in
+  let set_hash bdb =
+    if not (Type.writer omode) then fail bdb "no type_desc hash in header (open as writer to migrate)";
+    BDB.setopaque bdb 0 (Type.opaque_of_hash hash) in
+  let bdb = open_with (Type.cmpfunc ktype) in
+  let bdb =
+    match Type.hash_of_opaque (BDB.opaque bdb) with
+      | Some h -> if h <> hash then fail bdb "bad type_desc hash"; bdb
+      | None when BDB.rnum bdb = 0L -> set_hash bdb; bdb
+      | None ->
+          (* an older file may hold the hash under a key, which only the legacy comparator can handle *)
+          BDB.close bdb;
+          let bdb = open_with (Type.legacy_cmpfunc ktype) in
+          let legacy =
+            try Some (BDB.get bdb Type.legacy_hash_key)
+            with Error (Enorec, _, _) -> None in
+          begin match legacy with
+            | Some h when h <> hash -> fail bdb "bad type_desc hash"
+            | _ ->
+                (* XXX maybe should check that this is a fresh db? *)
+                set_hash bdb;
+                if legacy <> None then BDB.out bdb Type.legacy_hash_key
+          end;
+          BDB.close bdb;
+          open_with (Type.cmpfunc ktype) in
   {
     bdb = bdb;
     ktype = ktype;
     vtype = vtype;
   }
 
+let apply t wb = BDB.apply t.bdb wb.Write_batch.wb
 let close t = BDB.close t.bdb
 let copy t fn = BDB.copy t.bdb fn
+
+let find t k =
+  match Type.with_marshalled t.ktype k (BDB_raw.find t.bdb) with
+    | None -> None
+    | Some cstr ->
+        try
+          let v = t.vtype.Type.unmarshall cstr in
+          Cstr.del cstr;
+          Some v
+        with e -> Cstr.del cstr; raise e
+
+let unmarshall_del typ cstr =
+  try
+    let v = typ.Type.unmarshall cstr in
+    Cstr.del cstr;
+    v
+  with e -> Cstr.del cstr; raise e
+
+let fold_range t ?bkey ?binc ?ekey ?einc ?max ?chunk f a =
+  let marshall_key = function
+    | None -> None
+    | Some k -> Some (t.ktype.Type.marshall k) in
+  let bkey = marshall_key bkey in
+  let ekey = marshall_key ekey in
+  BDB_raw.fold_range t.bdb ?bkey ?binc ?ekey ?einc ?max ?chunk
+    (fun cstr a -> f (unmarshall_del t.ktype cstr) a)
+    a
+
+let fold_range_pairs t ?bkey ?binc ?ekey ?einc ?max ?chunk f a =
+  let marshall_key = function
+    | None -> None
+    | Some k -> Some (t.ktype.Type.marshall k) in
+  let bkey = marshall_key bkey in
+  let ekey = marshall_key ekey in
+  BDB_raw.fold_range_pairs t.bdb ?bkey ?binc ?ekey ?einc ?max ?chunk
+    (fun kcstr vcstr a ->
+       let k =
+         try unmarshall_del t.ktype kcstr
+         with e -> Cstr.del vcstr; raise e in
+       f k (unmarshall_del t.vtype vcstr) a)
+    a
+
 let fsiz t = BDB.fsiz t.bdb
 
 let get t k =
-  let cstr = BDB_raw.get t.bdb (Type.marshall_key t.ktype k "get") in
+  let cstr = Type.with_marshalled t.ktype k (BDB_raw.get t.bdb) in
   try
     let v = t.vtype.Type.unmarshall cstr in
     Cstr.del cstr;
@@ -157,38 +264,65 @@ let get t k =
 
 let getlist t k =
   Type.unmarshall_tclist t.vtype
-    (BDB_raw.getlist t.bdb (Type.marshall_key t.ktype k "getlist"))
+    (Type.with_marshalled t.ktype k (BDB_raw.getlist t.bdb))
 
 let optimize t ?lmemb ?nmemb ?bnum ?apow ?fpow ?opts () =
   BDB.optimize t.bdb ?lmemb ?nmemb ?bnum ?apow ?fpow ?opts ()
 
-let out t k = BDB_raw.out t.bdb (Type.marshall_key t.ktype k "out")
-let outlist t k = BDB_raw.outlist t.bdb (Type.marshall_key t.ktype k "outlist")
+let out t k = Type.with_marshalled t.ktype k (BDB_raw.out t.bdb)
+let outlist t k = Type.with_marshalled t.ktype k (BDB_raw.outlist t.bdb)
 let path t = BDB.path t.bdb
 
-let put t k v = BDB_raw.put t.bdb (Type.marshall_key t.ktype k "put") (t.vtype.Type.marshall v)
-let putdup t k v = BDB_raw.putdup t.bdb (Type.marshall_key t.ktype k "putdup") (t.vtype.Type.marshall v)
-let putkeep t k v = BDB_raw.putkeep t.bdb (Type.marshall_key t.ktype k "putkeep") (t.vtype.Type.marshall v)
+let put_with put put_ba t k v =
+  Type.with_marshalled t.ktype k (fun k ->
+    match t.vtype.Type.write with
+      | None -> put t.bdb k (t.vtype.Type.marshall v)
+      | Some write -> Type.written write v (fun buf len -> put_ba t.bdb k buf 0 len))
+
+let put t k v = put_with BDB_raw.put BDB_raw.put_ba t k v
+let putdup t k v = put_with BDB_raw.putdup BDB_raw.putdup_ba t k v
+let putkeep t k v = put_with BDB_raw.putkeep BDB_raw.putkeep_ba t k v
 let putlist t k vs =
   let tclist = Type.marshall_tclist t.vtype vs in
   try
-    BDB_raw.putlist t.bdb (Type.marshall_key t.ktype k "putlist") tclist;
+    Type.with_marshalled t.ktype k (fun k -> BDB_raw.putlist t.bdb k tclist);
     Tclist.del tclist
   with e -> Tclist.del tclist
 
 let range t ?bkey ?binc ?ekey ?einc ?max () =
   let marshall_key = function
     | None -> None
-    | Some k -> Some (Type.marshall_key t.ktype k "range") in
+    | Some k -> Some (t.ktype.Type.marshall k) in
   let bkey = marshall_key bkey in
   let ekey = marshall_key ekey in
   Type.unmarshall_tclist t.ktype
     (BDB_raw.range t.bdb ?bkey ?binc ?ekey ?einc ?max ())
 
+let range_pairs t ?bkey ?binc ?ekey ?einc ?max () =
+  List.rev (fold_range_pairs t ?bkey ?binc ?ekey ?einc ?max (fun k v l -> (k, v) :: l) [])
+
 let rnum t = BDB.rnum t.bdb
 let setcache t ?lcnum ?ncnum () = BDB.setcache t.bdb ?lcnum ?ncnum ()
 let setdfunit t dfunit = BDB.setdfunit t.bdb dfunit
 let setxmsiz t xmsiz = BDB.setxmsiz t.bdb xmsiz
+
+let split t n =
+  if n <= 1 then []
+  else begin
+    (* evenly spaced among the upper tree's keys, so no leaf is read *)
+    let keys = Array.of_list (BDB.separators t.bdb (n - 1)) in
+    let len = Array.length keys in
+    let rec loop i l =
+      if i = n then List.rev l
+      else
+        let k = keys.(i * len / n) in
+        match l with
+          | k' :: _ when k' = k -> loop (i + 1) l
+          | _ -> loop (i + 1) (k :: l) in
+    if len = 0 then []
+    else List.map (fun k -> t.ktype.Type.unmarshall (Cstr.of_string k)) (loop 1 [])
+  end
+
 let sync t = BDB.sync t.bdb
 let tranabort t = BDB.tranabort t.bdb
 let tranbegin t = BDB.tranbegin t.bdb
@@ -198,11 +332,17 @@ let tune t ?lmemb ?nmemb ?bnum ?apow ?fpow ?opts () =
   BDB.tune t.bdb ?lmemb ?nmemb ?bnum ?apow ?fpow ?opts ()
 
 let vanish t = BDB.vanish t.bdb
-let vnum t k = BDB_raw.vnum t.bdb (Type.marshall_key t.ktype k "vnum")
-let vsiz t k = BDB_raw.vsiz t.bdb (Type.marshall_key t.ktype k "vsiz")
+let vnum t k = Type.with_marshalled t.ktype k (BDB_raw.vnum t.bdb)
+let vsiz t k = Type.with_marshalled t.ktype k (BDB_raw.vsiz t.bdb)
 
 let cursor t = {
   Cursor.bdbcur = BDBCUR.new_ t.bdb;
   ktype = t.ktype;
   vtype = t.vtype;
 }
+
+let write_batch t = {
+  Write_batch.wb = Tokyo_cabinet.Write_batch.new_ ();
+  ktype = t.ktype;
+  vtype = t.vtype;
+}
@@ -9,18 +9,44 @@ sig
   val key : ('k, 'v) t -> 'k
   val last : ('k, 'v) t -> unit
   val next : ('k, 'v) t -> unit
+  val next_n : ('k, 'v) t -> int -> ('k * 'v) array
   val out : ('k, 'v) t -> unit
   val prev : ('k, 'v) t -> unit
+  val prev_n : ('k, 'v) t -> int -> ('k * 'v) array
   val put : ('k, 'v) t -> ?cpmode:BDBCUR.cpmode -> 'v -> unit
   val val_ : ('k, 'v) t -> 'v
 end
 
+module Write_batch :
+sig
+  type ('k, 'v) t
+
+  val clear : ('k, 'v) t -> unit
+  val num : ('k, 'v) t -> int
+  val out : ('k, 'v) t -> 'k -> unit
+  val put : ('k, 'v) t -> 'k -> 'v -> unit
+  val putkeep : ('k, 'v) t -> 'k -> 'v -> unit
+end
+
 type ('k, 'v) t
 
 val open_ : ?omode:omode list -> 'k Otoky_type.t -> 'v Otoky_type.t -> string -> ('k, 'v) t
 
+val apply : ('k, 'v) t -> ('k, 'v) Write_batch.t -> unit
 val close : ('k, 'v) t -> unit
 val copy : ('k, 'v) t -> string -> unit
+val find : ('k, 'v) t -> 'k -> 'v option
+
+val fold_range :
+  ('k, 'v) t ->
+  ?bkey:'k -> ?binc:bool -> ?ekey:'k -> ?einc:bool -> ?max:int -> ?chunk:int ->
+  ('k -> 'a -> 'a) -> 'a -> 'a
+
+val fold_range_pairs :
+  ('k, 'v) t ->
+  ?bkey:'k -> ?binc:bool -> ?ekey:'k -> ?einc:bool -> ?max:int -> ?chunk:int ->
+  ('k -> 'v -> 'a -> 'a) -> 'a -> 'a
+
 val fsiz : ('k, 'v) t -> int64
 val get : ('k, 'v) t -> 'k -> 'v
 val getlist : ('k, 'v) t -> 'k -> 'v list
@@ -43,10 +69,23 @@ val range :
   ?bkey:'k -> ?binc:bool -> ?ekey:'k -> ?einc:bool -> ?max:int -> unit ->
   'k list
 
+val range_pairs :
+  ('k, 'v) t ->
+  ?bkey:'k -> ?binc:bool -> ?ekey:'k -> ?einc:bool -> ?max:int -> unit ->
+  ('k * 'v) list
+
 val rnum : ('k, 'v) t -> int64
 val setcache : ('k, 'v) t -> ?lcnum:int32 -> ?ncnum:int32 -> unit -> unit
 val setdfunit : ('k, 'v) t -> int32 -> unit
 val setxmsiz : ('k, 'v) t -> int64 -> unit
+
+(*
+  up to n - 1 ascending keys splitting the records into n roughly
+  equal ranges, taken from the upper levels of the tree without
+  reading any leaf; fewer for a small tree or one not yet synced.
+*)
+val split : ('k, 'v) t -> int -> 'k list
+
 val sync : ('k, 'v) t -> unit
 val tranabort : ('k, 'v) t -> unit
 val tranbegin : ('k, 'v) t -> unit
@@ -62,3 +101,4 @@ val vnum : ('k, 'v) t -> 'k -> int
 val vsiz : ('k, 'v) t -> 'k -> int
 
 val cursor : ('k, 'v) t -> ('k, 'v) Cursor.t
+val write_batch : ('k, 'v) t -> ('k, 'v) Write_batch.t
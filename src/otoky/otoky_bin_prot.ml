@@ -1,11 +1,18 @@
 open Tokyo_common
 
+let write bin v buf pos =
+  try bin.Bin_prot.Type_class.writer.Bin_prot.Type_class.write buf ~pos v
+  with Bin_prot.Common.Buffer_short -> raise Otoky_type.Buffer_short
+
 let marshall bin v =
-  let len = bin.Bin_prot.Type_class.writer.Bin_prot.Type_class.size v in
-  let buf = Bin_prot.Common.create_buf len in
-  ignore (bin.Bin_prot.Type_class.writer.Bin_prot.Type_class.write buf ~pos:0 v);
-  Cstr.of_bigarray buf
+  Otoky_type.written (write bin) v (fun buf len ->
+    let s = String.create len in
+    Bin_prot.Common.blit_buf_string buf s ~len;
+    Cstr.of_string s)
 
 let unmarshall bin cstr =
   let buf = Cstr.to_bigarray cstr in
   bin.Bin_prot.Type_class.reader.Bin_prot.Type_class.read buf ~pos_ref:(ref 0)
+
+let make ~type_desc ~compare bin =
+  Otoky_type.make ~write:(write bin) ~type_desc ~marshall:(marshall bin) ~unmarshall:(unmarshall bin) ~compare ()
@@ -1,4 +1,19 @@
 open Tokyo_common
 
+(*
+  writes through the pooled buffer, then copies into a string; only
+  calls that keep several keys at once (mget, ranges) use it. make
+  also sets write, so single keys reach the stubs as a view of the
+  pooled buffer and values go straight to the *_ba stubs.
+*)
 val marshall : 'a Bin_prot.Type_class.t -> 'a -> Cstr.t
 val unmarshall : 'a Bin_prot.Type_class.t -> Cstr.t -> 'a
+
+(* write at pos, returning the end pos; raises Otoky_type.Buffer_short *)
+val write : 'a Bin_prot.Type_class.t -> 'a -> Cstr.buf -> int -> int
+
+val make :
+  type_desc : 'a Type_desc.t ->
+  compare : ('a -> 'a -> int) ->
+  'a Bin_prot.Type_class.t ->
+  'a Otoky_type.t
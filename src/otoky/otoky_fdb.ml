@@ -21,10 +21,13 @@ let to_raw_key k func =
 
 let of_raw_key k = Int64.pred k
 
+let check_len t len func =
+  if Int32.of_int len > t.width
+  then raise (Error (Einvalid, func, "marshalled value exceeds width"))
+
 let marshall t v func =
   let (_, len) as vm = t.vtype.Type.marshall v in
-  if Int32.of_int len > t.width
-  then raise (Error (Einvalid, func, "marshalled value exceeds width"));
+  check_len t len func;
   vm
 
 let check_width vtype width =
@@ -61,6 +64,32 @@ let open_ ?omode ?width vtype fn =
 
 let close t = FDB.close t.fdb
 let copy t fn = FDB.copy t.fdb fn
+
+let find t k =
+  match FDB_raw.find t.fdb (to_raw_key k "find") with
+    | None -> None
+    | Some cstr ->
+        try
+          let v = t.vtype.Type.unmarshall cstr in
+          Cstr.del cstr;
+          Some v
+        with e -> Cstr.del cstr; raise e
+
+let fold t ?chunk f a =
+  FDB_raw.fold t.fdb ?chunk
+    (fun k cstr a ->
+       if k = 1L (* type_desc hash *)
+       then begin Cstr.del cstr; a end
+       else
+         let v =
+           try
+             let v = t.vtype.Type.unmarshall cstr in
+             Cstr.del cstr;
+             v
+           with e -> Cstr.del cstr; raise e in
+         f (of_raw_key k) v a)
+    a
+
 let fsiz t = FDB.fsiz t.fdb
 
 let get t k =
@@ -71,6 +100,8 @@ let get t k =
     v
   with e -> Cstr.del cstr; raise e
 
+let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
+
 let iterinit t =
   FDB.iterinit t.fdb;
   ignore (FDB.iternext t.fdb)
@@ -92,11 +123,16 @@ let out t k =
 
 let path t = FDB.path t.fdb
 
-let put t k v =
-  FDB_raw.put t.fdb (to_raw_key k "put") (marshall t v "put")
+let put_with put put_ba t k v func =
+  let k = to_raw_key k func in
+  match t.vtype.Type.write with
+    | None -> put t.fdb k (marshall t v func)
+    | Some write ->
+        Type.written write v (fun buf len -> check_len t len func; put_ba t.fdb k buf 0 len)
+
+let put t k v = put_with FDB_raw.put FDB_raw.put_ba t k v "put"
 
-let putkeep t k v =
-  FDB_raw.putkeep t.fdb (to_raw_key k "putkeep") (marshall t v "putkeep")
+let putkeep t k v = put_with FDB_raw.putkeep FDB_raw.putkeep_ba t k v "putkeep"
 
 let range t ?lower ?upper ?max () =
   let lower = match lower with None -> Some 2L | Some k -> Some (to_raw_key k "range") in
@@ -105,6 +141,15 @@ let range t ?lower ?upper ?max () =
   Array.iteri (fun i k -> range.(i) <- of_raw_key k) range;
   range
 
+let range_ba t ?lower ?upper ?max () =
+  let lower = match lower with None -> Some 2L | Some k -> Some (to_raw_key k "range_ba") in
+  let upper = match upper with None -> None | Some k -> Some (to_raw_key k "range_ba") in
+  let range = FDB.range_ba t.fdb ?lower ?upper ?max () in
+  for i = 0 to Bigarray.Array1.dim range - 1 do
+    Bigarray.Array1.unsafe_set range i (of_raw_key (Bigarray.Array1.unsafe_get range i))
+  done;
+  range
+
 let rnum t = FDB.rnum t.fdb
 let sync t = FDB.sync t.fdb
 let tranabort t = FDB.tranabort t.fdb
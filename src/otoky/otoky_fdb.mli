@@ -6,8 +6,11 @@ val open_ : ?omode:omode list -> ?width:int32 -> 'v Otoky_type.t -> string -> 'v
 
 val close : 'v t -> unit
 val copy : 'v t -> string -> unit
+val find : 'v t -> int64 -> 'v option
+val fold : 'v t -> ?chunk:int -> (int64 -> 'v -> 'a -> 'a) -> 'a -> 'a
 val fsiz : 'v t -> int64
 val get : 'v t -> int64 -> 'v
+val iter : 'v t -> ?chunk:int -> (int64 -> 'v -> unit) -> unit
 val iterinit : 'v t -> unit
 val iternext : 'v t -> int64
 val optimize : 'v t -> ?width:int32 -> ?limsiz:int64 -> unit -> unit
@@ -16,6 +19,11 @@ val path : 'v t -> string
 val put : 'v t -> int64 -> 'v -> unit
 val putkeep : 'v t -> int64 -> 'v -> unit
 val range : 'v t -> ?lower:int64 -> ?upper:int64 -> ?max:int -> unit -> int64 array
+
+val range_ba :
+  'v t -> ?lower:int64 -> ?upper:int64 -> ?max:int -> unit ->
+  (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array1.t
+
 val rnum : 'v t -> int64
 val sync : 'v t -> unit
 val tranabort : 'v t -> unit
@@ -5,24 +5,25 @@ module Type =
 struct
   include Otoky_type
 
-  let type_desc_hash_key = "__otoky_type_desc_hash__"
-
-  let is_type_desc_hash_key k klen =
-    (* argh. maybe we should store the type_desc hash somewhere else. but where? *)
-    if klen <> String.length type_desc_hash_key
-    then false
-    else
-      let rec loop i =
-        if i = klen then true
-        else if String.unsafe_get k i <> String.unsafe_get type_desc_hash_key i then false
-        else loop (i + 1) in
-      loop 0
-
-  let marshall_key t k func =
-    let (k, klen) as mk = t.marshall k in
-    if is_type_desc_hash_key k klen
-    then raise (Error (Einvalid, func, "marshalled value is type_desc_hash key"))
-    else mk
+  (* where the type_desc hash was kept before it moved to the opaque header *)
+  let legacy_hash_key = "__otoky_type_desc_hash__"
+end
+
+module Write_batch =
+struct
+  module WB_raw = Write_batch.Fun (Cstr_cstr)
+
+  type ('k, 'v) t = {
+    wb : Write_batch.t;
+    ktype : 'k Type.t;
+    vtype : 'v Type.t;
+  }
+
+  let clear t = Write_batch.clear t.wb
+  let num t = Write_batch.num t.wb
+  let out t k = Type.with_marshalled t.ktype k (WB_raw.out t.wb)
+  let put t k v = Type.with_marshalled t.ktype k (fun k -> WB_raw.put t.wb k (t.vtype.Type.marshall v))
+  let putkeep t k v = Type.with_marshalled t.ktype k (fun k -> WB_raw.putkeep t.wb k (t.vtype.Type.marshall v))
 end
 
 module HDB_raw = HDB.Fun (Cstr_cstr) (Tclist_tclist)
@@ -33,19 +34,29 @@ type ('k, 'v) t = {
   vtype : 'v Type.t;
 }
 
+let check_type_desc_hash ?omode ktype vtype hdb =
+  let hash = Type.type_desc_hash ktype ^ Type.type_desc_hash vtype in
+  let fail msg = raise (Error (Einvalid, "open_", msg)) in
+  match Type.hash_of_opaque (HDB.opaque hdb) with
+    | Some h -> if h <> hash then fail "bad type_desc hash"
+    | None ->
+        let legacy =
+          try Some (HDB.get hdb Type.legacy_hash_key)
+          with Error (Enorec, _, _) -> None in
+        match legacy with
+          | Some h when h <> hash -> fail "bad type_desc hash"
+          | _ when not (Type.writer omode) -> fail "no type_desc hash in header (open as writer to migrate)"
+          | _ ->
+              (* XXX maybe should check that this is a fresh db? *)
+              HDB.setopaque hdb 0 (Type.opaque_of_hash hash);
+              if legacy <> None then HDB.out hdb Type.legacy_hash_key
+
 let open_ ?omode ktype vtype fn =
   let hdb = HDB.new_ () in
   HDB.open_ hdb ?omode fn;
-  let hash = Type.type_desc_hash ktype ^ Type.type_desc_hash vtype in
-  begin try
-    if hash <> HDB.get hdb Type.type_desc_hash_key
-    then begin
-      HDB.close hdb;
-      raise (Error (Einvalid, "open_", "bad type_desc hash"))
-    end
-  with Error (Enorec, _, _) ->
-    (* XXX maybe should check that this is a fresh db? *)
-    HDB.put hdb Type.type_desc_hash_key hash;
+  begin
+    try check_type_desc_hash ?omode ktype vtype hdb
+    with e -> HDB.close hdb; raise e
   end;
   {
     hdb = hdb;
@@ -53,36 +64,85 @@ let open_ ?omode ktype vtype fn =
     vtype = vtype;
   }
 
+let apply t wb = HDB.apply t.hdb wb.Write_batch.wb
 let close t = HDB.close t.hdb
 let copy t fn = HDB.copy t.hdb fn
+
+let find t k =
+  match Type.with_marshalled t.ktype k (HDB_raw.find t.hdb) with
+    | None -> None
+    | Some cstr ->
+        try
+          let v = t.vtype.Type.unmarshall cstr in
+          Cstr.del cstr;
+          Some v
+        with e -> Cstr.del cstr; raise e
+
+let unmarshall_del typ cstr =
+  try
+    let v = typ.Type.unmarshall cstr in
+    Cstr.del cstr;
+    v
+  with e -> Cstr.del cstr; raise e
+
+let unmarshall_pair t f kcstr vcstr a =
+  let k =
+    try unmarshall_del t.ktype kcstr
+    with e -> Cstr.del vcstr; raise e in
+  f k (unmarshall_del t.vtype vcstr) a
+
+let fold t ?chunk f a = HDB_raw.fold t.hdb ?chunk (unmarshall_pair t f) a
+let fold_slice t ?chunk slice f a = HDB_raw.fold_slice t.hdb ?chunk slice (unmarshall_pair t f) a
+
 let fsiz t = HDB.fsiz t.hdb
 
 let get t k =
-  let cstr = HDB_raw.get t.hdb (Type.marshall_key t.ktype k "get") in
+  let cstr = Type.with_marshalled t.ktype k (HDB_raw.get t.hdb) in
   try
     let v = t.vtype.Type.unmarshall cstr in
     Cstr.del cstr;
     v
   with e -> Cstr.del cstr; raise e
 
+let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
 let iterinit t = HDB.iterinit t.hdb
 
 let iternext t =
-  let (k, klen) as cstr = HDB_raw.iternext t.hdb in
-  let cstr =
-    if Type.is_type_desc_hash_key k klen
-    then (Cstr.del cstr; HDB_raw.iternext t.hdb)
-    else cstr in
+  let cstr = HDB_raw.iternext t.hdb in
   let k = t.ktype.Type.unmarshall cstr in
   Cstr.del cstr;
   k
 
+let mget t ks =
+  let cstrs = HDB_raw.mget t.hdb (Array.map t.ktype.Type.marshall ks) in
+  let del_from i =
+    for j = i to Array.length cstrs - 1 do
+      match cstrs.(j) with Some cstr -> Cstr.del cstr | None -> ()
+    done in
+  Array.mapi
+    (fun i -> function
+       | None -> None
+       | Some cstr ->
+           try
+             let v = t.vtype.Type.unmarshall cstr in
+             Cstr.del cstr;
+             Some v
+           with e -> del_from i; raise e)
+    cstrs
+
 let optimize t ?bnum ?apow ?fpow ?opts () = HDB.optimize t.hdb ?bnum ?apow ?fpow ?opts ()
-let out t k = HDB_raw.out t.hdb (Type.marshall_key t.ktype k "out")
+let out t k = Type.with_marshalled t.ktype k (HDB_raw.out t.hdb)
+let partition t num = HDB.partition t.hdb num
 let path t = HDB.path t.hdb
-let put t k v = HDB_raw.put t.hdb (Type.marshall_key t.ktype k "put") (t.vtype.Type.marshall v)
-let putasync t k v = HDB_raw.putasync t.hdb (Type.marshall_key t.ktype k "putasync") (t.vtype.Type.marshall v)
-let putkeep t k v = HDB_raw.putkeep t.hdb (Type.marshall_key t.ktype k "putkeep") (t.vtype.Type.marshall v)
+let put_with put put_ba t k v =
+  Type.with_marshalled t.ktype k (fun k ->
+    match t.vtype.Type.write with
+      | None -> put t.hdb k (t.vtype.Type.marshall v)
+      | Some write -> Type.written write v (fun buf len -> put_ba t.hdb k buf 0 len))
+
+let put t k v = put_with HDB_raw.put HDB_raw.put_ba t k v
+let putasync t k v = Type.with_marshalled t.ktype k (fun k -> HDB_raw.putasync t.hdb k (t.vtype.Type.marshall v))
+let putkeep t k v = put_with HDB_raw.putkeep HDB_raw.putkeep_ba t k v
 let rnum t = HDB.rnum t.hdb
 let setcache t rcnum = HDB.setcache t.hdb rcnum
 let setdfunit t dfunit = HDB.setdfunit t.hdb dfunit
@@ -93,4 +153,10 @@ let tranbegin t = HDB.tranbegin t.hdb
 let trancommit t = HDB.trancommit t.hdb
 let tune t ?bnum ?apow ?fpow ?opts () = HDB.tune t.hdb ?bnum ?apow ?fpow ?opts ()
 let vanish t = HDB.vanish t.hdb
-let vsiz t k = HDB_raw.vsiz t.hdb (Type.marshall_key t.ktype k "vsiz")
+let vsiz t k = Type.with_marshalled t.ktype k (HDB_raw.vsiz t.hdb)
+
+let write_batch t = {
+  Write_batch.wb = Tokyo_cabinet.Write_batch.new_ ();
+  ktype = t.ktype;
+  vtype = t.vtype;
+}
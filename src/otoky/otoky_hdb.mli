@@ -1,17 +1,38 @@
 open Tokyo_cabinet
 
+module Write_batch :
+sig
+  type ('k, 'v) t
+
+  val clear : ('k, 'v) t -> unit
+  val num : ('k, 'v) t -> int
+  val out : ('k, 'v) t -> 'k -> unit
+  val put : ('k, 'v) t -> 'k -> 'v -> unit
+  val putkeep : ('k, 'v) t -> 'k -> 'v -> unit
+end
+
 type ('k, 'v) t
 
 val open_ : ?omode:omode list -> 'k Otoky_type.t -> 'v Otoky_type.t -> string -> ('k, 'v) t
 
+(* check (or, opening a writer, record) the key and value type_desc hash in an open HDB's header *)
+val check_type_desc_hash : ?omode:omode list -> 'k Otoky_type.t -> 'v Otoky_type.t -> HDB.t -> unit
+
+val apply : ('k, 'v) t -> ('k, 'v) Write_batch.t -> unit
 val close : ('k, 'v) t -> unit
 val copy : ('k, 'v) t -> string -> unit
+val find : ('k, 'v) t -> 'k -> 'v option
+val fold : ('k, 'v) t -> ?chunk:int -> ('k -> 'v -> 'a -> 'a) -> 'a -> 'a
+val fold_slice : ('k, 'v) t -> ?chunk:int -> int64 * int64 -> ('k -> 'v -> 'a -> 'a) -> 'a -> 'a
 val fsiz : ('k, 'v) t -> int64
 val get : ('k, 'v) t -> 'k -> 'v
+val iter : ('k, 'v) t -> ?chunk:int -> ('k -> 'v -> unit) -> unit
 val iterinit : ('k, 'v) t -> unit
 val iternext : ('k, 'v) t -> 'k
+val mget : ('k, 'v) t -> 'k array -> 'v option array
 val optimize : ('k, 'v) t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
 val out : ('k, 'v) t -> 'k -> unit
+val partition : ('k, 'v) t -> int -> (int64 * int64) array
 val path : ('k, 'v) t -> string
 val put : ('k, 'v) t -> 'k -> 'v -> unit
 val putasync : ('k, 'v) t -> 'k -> 'v -> unit
@@ -27,3 +48,5 @@ val trancommit : ('k, 'v) t -> unit
 val tune : ('k, 'v) t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
 val vanish : ('k, 'v) t -> unit
 val vsiz : ('k, 'v) t -> 'k -> int
+
+val write_batch : ('k, 'v) t -> ('k, 'v) Write_batch.t
@@ -0,0 +1,12 @@
+open Tokyo_threads
+
+let bdb_fold t ~workers ?chunk f combine a =
+  let rec ranges bkey = function
+    | [] -> [ (bkey, None) ]
+    | k :: ks -> (bkey, Some k) :: ranges (Some k) ks in
+  let fold (bkey, ekey) () =
+    Otoky_bdb.fold_range_pairs t ?bkey ~binc:true ?ekey ~einc:false ?chunk f a in
+  let ths = List.map (fun r -> spawn (fold r)) (ranges None (Otoky_bdb.split t workers)) in
+  match join_all ths with
+    | [] -> a
+    | r :: rs -> List.fold_left combine r rs
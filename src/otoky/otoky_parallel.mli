@@ -0,0 +1,23 @@
+(*
+  scans of a disk-bound database split across threads, so their page
+  reads overlap. only the C reads run in parallel: unmarshalling and f
+  take the OCaml runtime lock and stay serialized, so a scan bound by
+  decoding or by f should use a plain fold instead.
+*)
+
+(*
+  folds f over each of workers key ranges in its own thread, each
+  with its own cursor and starting from a, then combines the results
+  in key order.
+*)
+val bdb_fold :
+  ('k, 'v) Otoky_bdb.t -> workers:int -> ?chunk:int ->
+  ('k -> 'v -> 'a -> 'a) -> ('a -> 'a -> 'a) -> 'a -> 'a
+
+(*
+  there is no HDB version: Tokyo Cabinet reads hash records only
+  through the handle's single iterator, so slices of one handle take
+  turns on it, and a second handle on the file would drop the
+  process's locks when closed. Otoky_hdb.fold_slice still reads a
+  slice at a time.
+*)
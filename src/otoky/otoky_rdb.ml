@@ -0,0 +1,110 @@
+open Tokyo_common
+open Tokyo_tyrant
+
+module Type = Otoky_type
+
+let hash_key = "__otoky_type_desc_hash__"
+
+module RDB_raw = RDB.Fun (Cstr_cstr) (Tclist_tclist) (Tcmap_tcmap)
+
+type ('k, 'v) t = {
+  rdb : RDB.t;
+  hash : string;
+  ktype : 'k Type.t;
+  vtype : 'v Type.t;
+}
+
+let check_hash rdb hash =
+  let fail () = raise (Error (Einvalid, "open_", "bad type_desc hash")) in
+  try
+    if RDB.get rdb hash_key <> hash then fail ()
+  with Error (Enorec, _, _) ->
+    try RDB.putkeep rdb hash_key hash
+    with Error (Ekeep, _, _) -> if RDB.get rdb hash_key <> hash then fail ()
+
+let open_ ktype vtype host port =
+  let rdb = RDB.new_ () in
+  RDB.open_ rdb host port;
+  let hash = Type.type_desc_hash ktype ^ Type.type_desc_hash vtype in
+  begin
+    try check_hash rdb hash
+    with e -> RDB.close rdb; raise e
+  end;
+  {
+    rdb = rdb;
+    hash = hash;
+    ktype = ktype;
+    vtype = vtype;
+  }
+
+let close t = RDB.close t.rdb
+
+(* marshalled keys may be naked C pointers, so read them only with unsafe_get *)
+let is_hash_key (s, len) =
+  if len <> String.length hash_key
+  then false
+  else
+    let rec loop i =
+      if i = len then true
+      else if String.unsafe_get s i <> String.unsafe_get hash_key i then false
+      else loop (i + 1) in
+    loop 0
+
+let with_key t k func f =
+  Type.with_marshalled t.ktype k (fun mk ->
+    if is_hash_key mk
+    then raise (Error (Einvalid, func, "marshalled key is type_desc hash key"))
+    else f mk)
+
+let unmarshall_del typ cstr =
+  try
+    let v = typ.Type.unmarshall cstr in
+    Cstr.del cstr;
+    v
+  with e -> Cstr.del cstr; raise e
+
+(* calls the script function name on the server with key and value, returning its result as a value *)
+let ext t ?xopts name k v =
+  unmarshall_del t.vtype (with_key t k "ext" (fun k -> RDB_raw.ext t.rdb ?xopts name k (t.vtype.Type.marshall v)))
+
+let find t k =
+  try Some (unmarshall_del t.vtype (with_key t k "find" (RDB_raw.get t.rdb)))
+  with Error (Enorec, _, _) -> None
+
+let fold t ?chunk f a =
+  RDB_raw.fold t.rdb ?chunk
+    (fun kcstr vcstr a ->
+       if is_hash_key kcstr
+       then begin Cstr.del kcstr; Cstr.del vcstr; a end
+       else
+         let k =
+           try unmarshall_del t.ktype kcstr
+           with e -> Cstr.del vcstr; raise e in
+         f k (unmarshall_del t.vtype vcstr) a)
+    a
+
+let get t k = unmarshall_del t.vtype (with_key t k "get" (RDB_raw.get t.rdb))
+let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
+let out t k = with_key t k "out" (RDB_raw.out t.rdb)
+
+let put_with func put put_ba t k v =
+  with_key t k func (fun k ->
+    match t.vtype.Type.write with
+      | None -> put t.rdb k (t.vtype.Type.marshall v)
+      | Some write -> Type.written write v (fun buf len -> put_ba t.rdb k buf 0 len))
+
+let put t k v = put_with "put" RDB_raw.put RDB_raw.put_ba t k v
+let putkeep t k v = put_with "putkeep" RDB_raw.putkeep RDB_raw.putkeep_ba t k v
+let putnr t k v = with_key t k "putnr" (fun k -> RDB_raw.putnr t.rdb k (t.vtype.Type.marshall v))
+let rnum t =
+  let n = RDB.rnum t.rdb in
+  try ignore (RDB.vsiz t.rdb hash_key); Int64.pred n
+  with Error (Enorec, _, _) -> n
+let sync t = RDB.sync t.rdb
+let tune t ?timeout ?topts () = RDB.tune t.rdb ?timeout ?topts ()
+
+let vanish t =
+  RDB.vanish t.rdb;
+  RDB.put t.rdb hash_key t.hash
+
+let vsiz t k = with_key t k "vsiz" (RDB_raw.vsiz t.rdb)
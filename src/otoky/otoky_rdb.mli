@@ -0,0 +1,27 @@
+open Tokyo_tyrant
+
+type ('k, 'v) t
+
+(*
+  a remote database has no header, so the type_desc hash is kept
+  under a reserved key. calls given a key that marshals to it raise
+  Error (Einvalid, _, _).
+*)
+val open_ : 'k Otoky_type.t -> 'v Otoky_type.t -> string -> int -> ('k, 'v) t
+
+val close : ('k, 'v) t -> unit
+(* runs a Lua function registered in ttserver; its result must be a marshalled 'v *)
+val ext : ('k, 'v) t -> ?xopts:xopt list -> string -> 'k -> 'v -> 'v
+val find : ('k, 'v) t -> 'k -> 'v option
+val fold : ('k, 'v) t -> ?chunk:int -> ('k -> 'v -> 'a -> 'a) -> 'a -> 'a
+val get : ('k, 'v) t -> 'k -> 'v
+val iter : ('k, 'v) t -> ?chunk:int -> ('k -> 'v -> unit) -> unit
+val out : ('k, 'v) t -> 'k -> unit
+val put : ('k, 'v) t -> 'k -> 'v -> unit
+val putkeep : ('k, 'v) t -> 'k -> 'v -> unit
+val putnr : ('k, 'v) t -> 'k -> 'v -> unit
+val rnum : ('k, 'v) t -> int64
+val sync : ('k, 'v) t -> unit
+val tune : ('k, 'v) t -> ?timeout:float -> ?topts:topt list -> unit -> unit
+val vanish : ('k, 'v) t -> unit
+val vsiz : ('k, 'v) t -> 'k -> int
@@ -0,0 +1,126 @@
+open Tokyo_common
+open Tokyo_cabinet
+
+module Type = Otoky_type
+
+module HDB_raw = HDB.Fun (Cstr_cstr) (Tclist_tclist)
+module Sharded_raw = Sharded_hdb.Fun (Cstr_cstr)
+
+type ('k, 'v) t = {
+  shdb : Sharded_hdb.t;
+  hdbs : HDB.t array;
+  ktype : 'k Type.t;
+  vtype : 'v Type.t;
+}
+
+module Write_batch =
+struct
+  module WB_raw = Write_batch.Fun (Cstr_cstr)
+
+  type ('k, 'v) t = {
+    wbs : Write_batch.t array;
+    shdb : Sharded_hdb.t;
+    ktype : 'k Type.t;
+    vtype : 'v Type.t;
+  }
+
+  let clear t = Array.iter Write_batch.clear t.wbs
+  let num t = Array.fold_left (fun n wb -> n + Write_batch.num wb) 0 t.wbs
+
+  (* f gets the shard's batch and the marshalled key *)
+  let with_wb t k f =
+    Type.with_marshalled t.ktype k (fun k -> f t.wbs.(Sharded_raw.shard t.shdb k) k)
+
+  let out t k = with_wb t k WB_raw.out
+  let put t k v = with_wb t k (fun wb k -> WB_raw.put wb k (t.vtype.Type.marshall v))
+  let putkeep t k v = with_wb t k (fun wb k -> WB_raw.putkeep wb k (t.vtype.Type.marshall v))
+end
+
+let open_ ?omode ktype vtype n fn =
+  let shdb = Sharded_hdb.new_ n in
+  Sharded_hdb.open_ shdb ?omode fn;
+  let hdbs = Sharded_hdb.shards shdb in
+  begin
+    try Array.iter (Otoky_hdb.check_type_desc_hash ?omode ktype vtype) hdbs
+    with e -> Sharded_hdb.close shdb; raise e
+  end;
+  {
+    shdb = shdb;
+    hdbs = hdbs;
+    ktype = ktype;
+    vtype = vtype;
+  }
+
+let apply t wb = Sharded_hdb.apply t.shdb wb.Write_batch.wbs
+let close t = Sharded_hdb.close t.shdb
+
+let unmarshall_del typ cstr =
+  try
+    let v = typ.Type.unmarshall cstr in
+    Cstr.del cstr;
+    v
+  with e -> Cstr.del cstr; raise e
+
+let find t k =
+  match Type.with_marshalled t.ktype k (Sharded_raw.find t.shdb) with
+    | None -> None
+    | Some cstr -> Some (unmarshall_del t.vtype cstr)
+
+let fold t ?chunk f a =
+  Sharded_raw.fold t.shdb ?chunk
+    (fun kcstr vcstr a ->
+       let k =
+         try unmarshall_del t.ktype kcstr
+         with e -> Cstr.del vcstr; raise e in
+       f k (unmarshall_del t.vtype vcstr) a)
+    a
+
+let fsiz t = Sharded_hdb.fsiz t.shdb
+let get t k = unmarshall_del t.vtype (Type.with_marshalled t.ktype k (Sharded_raw.get t.shdb))
+let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
+
+let mget t ks =
+  let cstrs = Sharded_raw.mget t.shdb (Array.map t.ktype.Type.marshall ks) in
+  let del_from i =
+    for j = i to Array.length cstrs - 1 do
+      match cstrs.(j) with Some cstr -> Cstr.del cstr | None -> ()
+    done in
+  Array.mapi
+    (fun i -> function
+       | None -> None
+       | Some cstr ->
+           try
+             let v = t.vtype.Type.unmarshall cstr in
+             Cstr.del cstr;
+             Some v
+           with e -> del_from i; raise e)
+    cstrs
+
+let optimize t ?bnum ?apow ?fpow ?opts () = Sharded_hdb.optimize t.shdb ?bnum ?apow ?fpow ?opts ()
+let out t k = Type.with_marshalled t.ktype k (Sharded_raw.out t.shdb)
+
+let put_with put put_ba t k v =
+  Type.with_marshalled t.ktype k (fun k ->
+    let hdb = t.hdbs.(Sharded_raw.shard t.shdb k) in
+    match t.vtype.Type.write with
+      | None -> put hdb k (t.vtype.Type.marshall v)
+      | Some write -> Type.written write v (fun buf len -> put_ba hdb k buf 0 len))
+
+let put t k v = put_with HDB_raw.put HDB_raw.put_ba t k v
+let putasync t k v = Type.with_marshalled t.ktype k (fun k -> Sharded_raw.putasync t.shdb k (t.vtype.Type.marshall v))
+let putkeep t k v = put_with HDB_raw.putkeep HDB_raw.putkeep_ba t k v
+let rnum t = Sharded_hdb.rnum t.shdb
+let setcache t rcnum = Sharded_hdb.setcache t.shdb rcnum
+let setdfunit t dfunit = Sharded_hdb.setdfunit t.shdb dfunit
+let setxmsiz t xmsiz = Sharded_hdb.setxmsiz t.shdb xmsiz
+let sync t = Sharded_hdb.sync t.shdb
+let tune t ?bnum ?apow ?fpow ?opts () = Sharded_hdb.tune t.shdb ?bnum ?apow ?fpow ?opts ()
+let vanish t = Sharded_hdb.vanish t.shdb
+let vsiz t k = Type.with_marshalled t.ktype k (Sharded_raw.vsiz t.shdb)
+
+let write_batch t = {
+  Write_batch.wbs = Sharded_hdb.write_batch t.shdb;
+  shdb = t.shdb;
+  ktype = t.ktype;
+  vtype = t.vtype;
+}
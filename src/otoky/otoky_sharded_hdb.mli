@@ -0,0 +1,41 @@
+open Tokyo_cabinet
+
+module Write_batch :
+sig
+  type ('k, 'v) t
+
+  val clear : ('k, 'v) t -> unit
+  val num : ('k, 'v) t -> int
+  val out : ('k, 'v) t -> 'k -> unit
+  val put : ('k, 'v) t -> 'k -> 'v -> unit
+  val putkeep : ('k, 'v) t -> 'k -> 'v -> unit
+end
+
+type ('k, 'v) t
+
+(* open_ ktype vtype n fn opens a table split across HDB files fn.0 .. fn.(n-1) *)
+val open_ : ?omode:omode list -> 'k Otoky_type.t -> 'v Otoky_type.t -> int -> string -> ('k, 'v) t
+
+val apply : ('k, 'v) t -> ('k, 'v) Write_batch.t -> unit
+val close : ('k, 'v) t -> unit
+val find : ('k, 'v) t -> 'k -> 'v option
+val fold : ('k, 'v) t -> ?chunk:int -> ('k -> 'v -> 'a -> 'a) -> 'a -> 'a
+val fsiz : ('k, 'v) t -> int64
+val get : ('k, 'v) t -> 'k -> 'v
+val iter : ('k, 'v) t -> ?chunk:int -> ('k -> 'v -> unit) -> unit
+val mget : ('k, 'v) t -> 'k array -> 'v option array
+val optimize : ('k, 'v) t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
+val out : ('k, 'v) t -> 'k -> unit
+val put : ('k, 'v) t -> 'k -> 'v -> unit
+val putasync : ('k, 'v) t -> 'k -> 'v -> unit
+val putkeep : ('k, 'v) t -> 'k -> 'v -> unit
+val rnum : ('k, 'v) t -> int64
+val setcache : ('k, 'v) t -> int32 -> unit
+val setdfunit : ('k, 'v) t -> int32 -> unit
+val setxmsiz : ('k, 'v) t -> int64 -> unit
+val sync : ('k, 'v) t -> unit
+val tune : ('k, 'v) t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
+val vanish : ('k, 'v) t -> unit
+val vsiz : ('k, 'v) t -> 'k -> int
+
+val write_batch : ('k, 'v) t -> ('k, 'v) Write_batch.t
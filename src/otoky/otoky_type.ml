@@ -1,17 +1,242 @@
 open Tokyo_common
 
+exception Buffer_short
+
+type field = F_int32 | F_int64 | F_string
+
 type 'a t = {
   type_desc : 'a Type_desc.t;
   marshall : 'a -> Cstr.t;
   unmarshall : Cstr.t -> 'a;
   compare : 'a -> 'a -> int; (* only needed for BDB *)
+  encoding : field list option; (* order-preserving, compared in C by BDB *)
+  write : ('a -> Cstr.buf -> int -> int) option; (* returns end pos, raises Buffer_short *)
 }
 
-let make ~type_desc ~marshall ~unmarshall ~compare = {
+let make ?encoding ?write ~type_desc ~marshall ~unmarshall ~compare () = {
   type_desc = type_desc;
   marshall = marshall;
   unmarshall = unmarshall;
   compare = compare;
+  encoding = encoding;
+  write = write;
 }
 
+(*
+  scratch buffers for write, kept on a fixed array stack. taking and
+  putting back a buffer don't allocate, so under the runtime lock no
+  other thread can run in between. new buffers start at the largest
+  size written so far, so a value normally goes in one pass; buffers
+  much larger than that are not kept.
+*)
+let max_pooled = 16
+let max_pooled_size = 1 lsl 20
+
+let no_buf = Bigarray.Array1.create Bigarray.char Bigarray.c_layout 0
+let bufs = Array.make max_pooled no_buf
+let nbufs = ref 0
+let buf_size = ref 4096
+
+let take_buf () =
+  if !nbufs > 0
+  then begin
+    decr nbufs;
+    let buf = bufs.(!nbufs) in
+    bufs.(!nbufs) <- no_buf;
+    buf
+  end
+  else Bigarray.Array1.create Bigarray.char Bigarray.c_layout !buf_size
+
+let give_buf buf =
+  if !nbufs < max_pooled && Bigarray.Array1.dim buf <= max_pooled_size
+  then begin bufs.(!nbufs) <- buf; incr nbufs end
+
+let written write v f =
+  let rec loop buf =
+    match (try Some (write v buf 0) with Buffer_short -> None) with
+      | Some len -> (buf, len)
+      | None ->
+          let size = 2 * Bigarray.Array1.dim buf in
+          if size <= max_pooled_size && size > !buf_size then buf_size := size;
+          loop (Bigarray.Array1.create Bigarray.char Bigarray.c_layout size) in
+  let (buf, len) = loop (take_buf ()) in
+  let r = try f buf len with e -> give_buf buf; raise e in
+  give_buf buf;
+  r
+
+let with_marshalled t v f =
+  match t.write with
+    | None -> f (t.marshall v)
+    | Some write -> written write v (fun buf len -> f (Cstr.of_bigarray buf len))
+
 let type_desc_hash t = Digest.string (Type_desc.to_string t.type_desc)
+
+let writer omode =
+  match omode with
+    | Some omode -> List.mem Tokyo_cabinet.Owriter omode
+    | None -> false
+
+(*
+  HDB and BDB keep the key and value type_desc hashes at the start of
+  the database's opaque header region, behind a magic string, so they
+  don't occupy a key.
+*)
+let opaque_magic = "otoky\001"
+
+let opaque_of_hash hash = opaque_magic ^ hash
+
+let hash_of_opaque opaque =
+  let mlen = String.length opaque_magic in
+  let hlen = 2 * String.length (Digest.string "") in
+  if String.length opaque >= mlen + hlen && String.sub opaque 0 mlen = opaque_magic
+  then Some (String.sub opaque mlen hlen)
+  else None
+
+(*
+  order-preserving encodings: ints are big-endian two's complement,
+  strings have a 4-byte big-endian length prefix, tuples are the
+  concatenation of their fields. marshalled keys may be naked C
+  pointers, so read them only with unsafe_get.
+*)
+
+let byte s i = Char.code (String.unsafe_get s i)
+
+let read_int64 s pos =
+  let rec loop i n =
+    if i = 8 then n
+    else loop (i + 1) (Int64.logor (Int64.shift_left n 8) (Int64.of_int (byte s (pos + i)))) in
+  loop 0 0L
+
+let write_int64 s pos n =
+  for i = 0 to 7 do
+    let b = Int64.to_int (Int64.shift_right_logical n (56 - 8 * i)) land 0xff in
+    String.unsafe_set s (pos + i) (Char.unsafe_chr b)
+  done
+
+let read_int32 s pos =
+  let rec loop i n =
+    if i = 4 then n
+    else loop (i + 1) (Int32.logor (Int32.shift_left n 8) (Int32.of_int (byte s (pos + i)))) in
+  loop 0 0l
+
+let write_int32 s pos n =
+  for i = 0 to 3 do
+    let b = Int32.to_int (Int32.shift_right_logical n (24 - 8 * i)) land 0xff in
+    String.unsafe_set s (pos + i) (Char.unsafe_chr b)
+  done
+
+let sub s pos len =
+  let r = String.create len in
+  for i = 0 to len - 1 do String.unsafe_set r i (String.unsafe_get s (pos + i)) done;
+  r
+
+(* raises Exit if the fields don't fit *)
+let rec fields_end fields s len pos =
+  match fields with
+    | [] -> pos
+    | f :: fields ->
+        let pos =
+          match f with
+            | F_int32 -> pos + 4
+            | F_int64 -> pos + 8
+            | F_string ->
+                if pos + 4 > len then raise Exit;
+                let n = Int32.to_int (read_int32 s pos) in
+                if n < 0 then raise Exit;
+                pos + 4 + n in
+        if pos > len then raise Exit;
+        fields_end fields s len pos
+
+let decodes fields (s, len) =
+  try fields_end fields s len 0 = len with Exit -> false
+
+let encoded type_desc fields marshall unmarshall compare = {
+  type_desc = Type_desc.hide type_desc;
+  marshall = marshall;
+  unmarshall = unmarshall;
+  compare = compare;
+  encoding = Some fields;
+  write = None;
+}
+
+let int32 =
+  encoded Type_desc.Int32 [ F_int32 ]
+    (fun n -> let s = String.create 4 in write_int32 s 0 n; (s, 4))
+    (fun (s, _) -> read_int32 s 0)
+    Int32.compare
+
+let int64 =
+  encoded Type_desc.Int64 [ F_int64 ]
+    (fun n -> let s = String.create 8 in write_int64 s 0 n; (s, 8))
+    (fun (s, _) -> read_int64 s 0)
+    Int64.compare
+
+let int =
+  encoded Type_desc.Int [ F_int64 ]
+    (fun n -> int64.marshall (Int64.of_int n))
+    (fun cstr -> Int64.to_int (int64.unmarshall cstr))
+    (compare : int -> int -> int)
+
+let string =
+  encoded Type_desc.String [ F_string ]
+    (fun v ->
+       let len = String.length v in
+       let s = String.create (4 + len) in
+       write_int32 s 0 (Int32.of_int len);
+       String.blit v 0 s 4 len;
+       (s, 4 + len))
+    (fun (s, len) -> sub s 4 (len - 4))
+    (compare : string -> string -> int)
+
+let fields_of t =
+  match t.encoding with
+    | Some fields -> fields
+    | None -> invalid_arg "Otoky_type: tuple component has no encoding"
+
+(* marshalled components are OCaml strings, so blit is safe *)
+let concat cstrs =
+  let len = List.fold_left (fun len (_, l) -> len + l) 0 cstrs in
+  let s = String.create len in
+  ignore (List.fold_left (fun pos (c, l) -> String.blit c 0 s pos l; pos + l) 0 cstrs);
+  (s, len)
+
+let split fields s len pos =
+  let pos' =
+    try fields_end fields s len pos
+    with Exit -> raise (Tokyo_cabinet.Error (Tokyo_cabinet.Einvalid, "unmarshall", "bad encoding")) in
+  ((sub s pos (pos' - pos), pos' - pos), pos')
+
+let tuple2 a b =
+  let fa = fields_of a and fb = fields_of b in
+  encoded
+    (Type_desc.Tuple [ Type_desc.show a.type_desc; Type_desc.show b.type_desc ])
+    (fa @ fb)
+    (fun (x, y) -> concat [ a.marshall x; b.marshall y ])
+    (fun (s, len) ->
+       let (ca, pos) = split fa s len 0 in
+       let (cb, _) = split fb s len pos in
+       (a.unmarshall ca, b.unmarshall cb))
+    (fun (x1, y1) (x2, y2) ->
+       match a.compare x1 x2 with
+         | 0 -> b.compare y1 y2
+         | r -> r)
+
+let tuple3 a b c =
+  let fa = fields_of a and fb = fields_of b and fc = fields_of c in
+  encoded
+    (Type_desc.Tuple [ Type_desc.show a.type_desc; Type_desc.show b.type_desc; Type_desc.show c.type_desc ])
+    (fa @ fb @ fc)
+    (fun (x, y, z) -> concat [ a.marshall x; b.marshall y; c.marshall z ])
+    (fun (s, len) ->
+       let (ca, pos) = split fa s len 0 in
+       let (cb, pos) = split fb s len pos in
+       let (cc, _) = split fc s len pos in
+       (a.unmarshall ca, b.unmarshall cb, c.unmarshall cc))
+    (fun (x1, y1, z1) (x2, y2, z2) ->
+       match a.compare x1 x2 with
+         | 0 ->
+             begin match b.compare y1 y2 with
+               | 0 -> c.compare z1 z2
+               | r -> r
+             end
+         | r -> r)
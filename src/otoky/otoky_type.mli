@@ -1,17 +1,54 @@
 open Tokyo_common
 
-type 'a t = {
+exception Buffer_short
+
+(* fields of an order-preserving encoding: big-endian ints, strings with a 4-byte big-endian length prefix *)
+type field = F_int32 | F_int64 | F_string
+
+type 'a t = private {
   type_desc : 'a Type_desc.t;
   marshall : 'a -> Cstr.t;
   unmarshall : Cstr.t -> 'a;
   compare : 'a -> 'a -> int; (* only needed for BDB *)
+  encoding : field list option; (* order-preserving, compared in C by BDB *)
+  write : ('a -> Cstr.buf -> int -> int) option; (* returns end pos, raises Buffer_short *)
 }
 
 val make :
+  ?encoding : field list ->
+  ?write : ('a -> Cstr.buf -> int -> int) ->
   type_desc : 'a Type_desc.t ->
   marshall : ('a -> Cstr.t) ->
   unmarshall : (Cstr.t -> 'a) ->
   compare : ('a -> 'a -> int) ->
+  unit ->
   'a t
 
 val type_desc_hash : 'a t -> string
+
+(* whether an open mode can write the hash *)
+val writer : Tokyo_cabinet.omode list option -> bool
+
+(* the opaque header contents for a key ^ value type_desc hash, and back *)
+val opaque_of_hash : string -> string
+val hash_of_opaque : string -> string option
+
+(* write v into a pooled scratch buffer and pass it and the length to f; the buffer is reused after f returns *)
+val written : ('a -> Cstr.buf -> int -> int) -> 'a -> (Cstr.buf -> int -> 'b) -> 'b
+
+(*
+  pass f v marshalled; with a write function it is a view of a pooled
+  buffer rather than a fresh string, so f must not keep it.
+*)
+val with_marshalled : 'a t -> 'a -> (Cstr.t -> 'b) -> 'b
+
+(* types with order-preserving encodings; BDB keys of these types are compared without calling back into OCaml *)
+
+val int : int t
+val int32 : int32 t
+val int64 : int64 t
+val string : string t
+val tuple2 : 'a t -> 'b t -> ('a * 'b) t
+val tuple3 : 'a t -> 'b t -> 'c t -> ('a * 'b * 'c) t
+
+val decodes : field list -> Cstr.t -> bool
@@ -0,0 +1,183 @@
+open Tokyo_cabinet
+
+type 'a outcome = 'a Tokyo_threads.outcome = Value of 'a | Exn of exn
+
+type 'a future = {
+  fm : Mutex.t;
+  fc : Condition.t;
+  mutable result : 'a outcome option;
+  mutable callbacks : ('a outcome -> unit) list;
+}
+
+type handle = Adb of ADB.t | Bdb of BDB.t | Fdb of FDB.t | Hdb of HDB.t | Tdb of TDB.t
+
+type writes = {
+  handle : handle;
+  queue : (unit -> unit) Queue.t;
+}
+
+type t = {
+  m : Mutex.t;
+  c : Condition.t;
+  jobs : (unit -> unit) Queue.t;
+  mutable writes : writes list;
+  mutable pending : int;
+  mutable closed : bool;
+  max_queue : int;
+  on_error : exn -> unit;
+  mutable threads : Thread.t list;
+}
+
+exception Queue_full
+
+let same h h' =
+  match h, h' with
+    | Adb a, Adb a' -> a == a'
+    | Bdb b, Bdb b' -> b == b'
+    | Fdb f, Fdb f' -> f == f'
+    | Hdb h, Hdb h' -> h == h'
+    | Tdb t, Tdb t' -> t == t'
+    | _ -> false
+
+let locked m f =
+  Mutex.lock m;
+  let r = Tokyo_threads.outcome f in
+  Mutex.unlock m;
+  Tokyo_threads.value r
+
+let new_future () = {
+  fm = Mutex.create ();
+  fc = Condition.create ();
+  result = None;
+  callbacks = [];
+}
+
+let complete t fut r =
+  let cbs =
+    locked fut.fm (fun () ->
+      fut.result <- Some r;
+      Condition.broadcast fut.fc;
+      let cbs = fut.callbacks in
+      fut.callbacks <- [];
+      cbs) in
+  (* a callback's exception must not kill the worker *)
+  List.iter (fun f -> try f r with e -> (try t.on_error e with _ -> ())) (List.rev cbs)
+
+let await fut =
+  let r =
+    locked fut.fm (fun () ->
+      let rec wait () =
+        match fut.result with
+          | Some r -> r
+          | None -> Condition.wait fut.fc fut.fm; wait () in
+      wait ()) in
+  Tokyo_threads.value r
+
+let peek fut = locked fut.fm (fun () -> fut.result)
+
+let on_complete fut f =
+  let r =
+    locked fut.fm (fun () ->
+      match fut.result with
+        | None -> fut.callbacks <- f :: fut.callbacks; None
+        | r -> r) in
+  match r with
+    | Some r -> f r
+    | None -> ()
+
+let worker t () =
+  let rec loop () =
+    let job =
+      locked t.m (fun () ->
+        while Queue.is_empty t.jobs && not t.closed do Condition.wait t.c t.m done;
+        if Queue.is_empty t.jobs then None else Some (Queue.pop t.jobs)) in
+    match job with
+      | None -> ()
+      | Some job -> job (); loop () in
+  loop ()
+
+let print_error e =
+  prerr_endline ("Async_cabinet: exception in on_complete callback: " ^ Printexc.to_string e)
+
+let create ?(threads = 4) ?(max_queue = 1024) ?(on_error = print_error) () =
+  if threads <= 0 || max_queue <= 0 then invalid_arg "create";
+  let t = {
+    m = Mutex.create ();
+    c = Condition.create ();
+    jobs = Queue.create ();
+    writes = [];
+    pending = 0;
+    closed = false;
+    max_queue = max_queue;
+    on_error = on_error;
+    threads = [];
+  } in
+  for i = 1 to threads do
+    t.threads <- Thread.create (worker t) () :: t.threads
+  done;
+  t
+
+let shutdown t =
+  let ths =
+    locked t.m (fun () ->
+      t.closed <- true;
+      Condition.broadcast t.c;
+      let ths = t.threads in
+      t.threads <- [];
+      ths) in
+  List.iter Thread.join ths
+
+let pending t = locked t.m (fun () -> t.pending)
+
+(* must hold t.m *)
+let reserve t func =
+  if t.closed then invalid_arg func;
+  if t.pending >= t.max_queue then raise Queue_full;
+  t.pending <- t.pending + 1
+
+let job t fut f () =
+  let r = Tokyo_threads.outcome f in
+  locked t.m (fun () -> t.pending <- t.pending - 1);
+  complete t fut r
+
+let run t f =
+  let fut = new_future () in
+  locked t.m (fun () ->
+    reserve t "run";
+    Queue.add (job t fut f) t.jobs;
+    Condition.signal t.c);
+  fut
+
+let drain t w () =
+  let rec loop () =
+    let batch =
+      locked t.m (fun () ->
+        if Queue.is_empty w.queue
+        then begin
+          t.writes <- List.filter (fun w' -> w' != w) t.writes;
+          None
+        end
+        else begin
+          let q = Queue.create () in
+          Queue.transfer w.queue q;
+          Some q
+        end) in
+    match batch with
+      | None -> ()
+      | Some q -> Queue.iter (fun job -> job ()) q; loop () in
+  loop ()
+
+let write t h f =
+  let fut = new_future () in
+  locked t.m (fun () ->
+    reserve t "write";
+    try
+      let w = List.find (fun w -> same w.handle h) t.writes in
+      Queue.add (job t fut f) w.queue
+    with Not_found ->
+      let w = { handle = h; queue = Queue.create () } in
+      Queue.add (job t fut f) w.queue;
+      t.writes <- w :: t.writes;
+      Queue.add (drain t w) t.jobs;
+      Condition.signal t.c);
+  fut
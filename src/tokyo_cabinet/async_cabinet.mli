@@ -0,0 +1,55 @@
+(*
+  runs Tokyo Cabinet calls on a bounded pool of system threads, so an
+  event loop need not block on sync, optimize, copy or cold reads. the
+  stubs release the runtime lock, so calls on different handles run in
+  parallel.
+*)
+
+open Tokyo_cabinet
+
+type t
+
+type 'a future
+
+type 'a outcome = 'a Tokyo_threads.outcome = Value of 'a | Exn of exn
+
+type handle = Adb of ADB.t | Bdb of BDB.t | Fdb of FDB.t | Hdb of HDB.t | Tdb of TDB.t
+
+(* raised by run and write when max_queue calls are already pending *)
+exception Queue_full
+
+(*
+  threads (default 4) and max_queue (default 1024) must be positive.
+  on_error gets exceptions raised by on_complete callbacks that run on
+  a worker thread; the default prints them to stderr.
+*)
+val create : ?threads:int -> ?max_queue:int -> ?on_error:(exn -> unit) -> unit -> t
+
+(* waits for pending calls to finish, then stops the threads *)
+val shutdown : t -> unit
+
+val pending : t -> int
+
+val run : t -> (unit -> 'a) -> 'a future
+
+(*
+  writes to the same handle run one at a time in submission order:
+  those queued while an earlier write to the handle is waiting or
+  running are run after it by the same thread, rather than as separate
+  jobs. they are not merged or put in a transaction; to commit several
+  writes together, bracket them with tranbegin and trancommit in one
+  write.
+*)
+val write : t -> handle -> (unit -> 'a) -> 'a future
+
+(* blocks the calling thread until the call completes *)
+val await : 'a future -> 'a
+
+val peek : 'a future -> 'a outcome option
+
+(*
+  f runs immediately if the call is done, and what it raises is passed
+  on; otherwise it runs on the worker thread, and what it raises goes
+  to on_error.
+*)
+val on_complete : 'a future -> ('a outcome -> unit) -> unit
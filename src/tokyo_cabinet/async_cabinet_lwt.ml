@@ -0,0 +1,16 @@
+let wait fut =
+  let waiter, wakener = Lwt.wait () in
+  let result = ref None in
+  let id =
+    Lwt_unix.make_notification ~once:true
+      (fun () ->
+         match !result with
+           | Some (Async_cabinet.Value v) -> Lwt.wakeup wakener v
+           | Some (Async_cabinet.Exn e) -> Lwt.wakeup_exn wakener e
+           | None -> ()) in
+  (* the callback may run on a worker thread, so hand off through a notification *)
+  Async_cabinet.on_complete fut (fun r -> result := Some r; Lwt_unix.send_notification id);
+  waiter
+
+let run t f = wait (Async_cabinet.run t f)
+let write t h f = wait (Async_cabinet.write t h f)
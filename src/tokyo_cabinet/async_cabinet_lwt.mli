@@ -0,0 +1,6 @@
+(* Lwt threads for Async_cabinet calls, woken on the Lwt main loop *)
+
+val wait : 'a Async_cabinet.future -> 'a Lwt.t
+
+val run : Async_cabinet.t -> (unit -> 'a) -> 'a Lwt.t
+val write : Async_cabinet.t -> Async_cabinet.handle -> (unit -> 'a) -> 'a Lwt.t
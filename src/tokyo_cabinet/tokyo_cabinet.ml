@@ -35,6 +35,76 @@ type omode = Oreader | Owriter | Ocreat | Otrunc | Onolck | Olcknb | Otsync
 
 type opt = Tlarge | Tdeflate | Tbzip | Ttcbs
 
+(* if f raises, the items not yet passed to it are freed *)
+let fold_chunk conv del f items a =
+  let len = Array.length items in
+  let rec loop a i =
+    if i = len then a
+    else
+      let a =
+        try f (conv items.(i)) a
+        with e -> for j = i + 1 to len - 1 do del items.(j) done; raise e in
+      loop a (i + 1) in
+  loop a 0
+
+module Write_batch =
+struct
+  type t
+
+  module type Sig =
+  sig
+    type cstr_t
+
+    val new_ : unit -> t
+
+    val clear : t -> unit
+    val num : t -> int
+    val out : t -> cstr_t -> unit
+    val out_id : t -> int64 -> unit
+    val put : t -> cstr_t -> cstr_t -> unit
+    val put_id : t -> int64 -> cstr_t -> unit
+    val putcat : t -> cstr_t -> cstr_t -> unit
+    val putcat_id : t -> int64 -> cstr_t -> unit
+    val putkeep : t -> cstr_t -> cstr_t -> unit
+    val putkeep_id : t -> int64 -> cstr_t -> unit
+  end
+
+  module Fun (Cs : Cstr_t) =
+  struct
+    type cstr_t = Cs.t
+
+    external new_ : unit -> t = "otoky_wb_new"
+
+    external clear : t -> unit = "otoky_wb_clear"
+    external num : t -> int = "otoky_wb_num"
+
+    external _out : t -> string -> int -> unit = "otoky_wb_out"
+    let out t key = _out t (Cs.string key) (Cs.length key)
+
+    external out_id : t -> int64 -> unit = "otoky_wb_out_id"
+
+    external _put : t -> string -> int -> string -> int -> unit = "otoky_wb_put"
+    let put t key value = _put t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
+
+    external _put_id : t -> int64 -> string -> int -> unit = "otoky_wb_put_id"
+    let put_id t key value = _put_id t key (Cs.string value) (Cs.length value)
+
+    external _putcat : t -> string -> int -> string -> int -> unit = "otoky_wb_putcat"
+    let putcat t key value = _putcat t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
+
+    external _putcat_id : t -> int64 -> string -> int -> unit = "otoky_wb_putcat_id"
+    let putcat_id t key value = _putcat_id t key (Cs.string value) (Cs.length value)
+
+    external _putkeep : t -> string -> int -> string -> int -> unit = "otoky_wb_putkeep"
+    let putkeep t key value = _putkeep t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
+
+    external _putkeep_id : t -> int64 -> string -> int -> unit = "otoky_wb_putkeep_id"
+    let putkeep_id t key value = _putkeep_id t key (Cs.string value) (Cs.length value)
+  end
+
+  include Fun (Cstr_string)
+end
+
 module ADB =
 struct
   type t
@@ -50,6 +120,7 @@ struct
     val addint : t -> cstr_t -> int -> int
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> cstr_t -> cstr_t option
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val get : t -> cstr_t -> cstr_t
     val iterinit : t -> unit
@@ -88,6 +159,15 @@ struct
     external close : t -> unit = "otoky_adb_close"
     external copy : t -> string -> unit = "otoky_adb_copy"
 
+    external _find : t -> string -> int -> Cstr.t option = "otoky_adb_find"
+    let find t key =
+      match _find t (Cs.string key) (Cs.length key) with
+        | None -> None
+        | Some cstr ->
+            let r = Cs.of_cstr cstr in
+            if Cs.del then Cstr.del cstr;
+            Some r
+
     external _fwmkeys : t -> ?max:int -> string -> int -> Tclist.t = "otoky_adb_fwmkeys"
     let fwmkeys t ?max prefix =
       let tclist = _fwmkeys t ?max (Cs.string prefix) (Cs.length prefix) in
@@ -160,9 +240,12 @@ end
 
 module BDB =
 struct
+  type cmpfield = Cf_int32 | Cf_int64 | Cf_string
+
   type cmpfunc =
       | Cmp_lexical | Cmp_decimal | Cmp_int32 | Cmp_int64
       | Cmp_custom of (string -> string -> int) | Cmp_custom_cstr of (string -> int -> string -> int -> int)
+      | Cmp_fields of cmpfield list
 
   type t
 
@@ -175,27 +258,45 @@ struct
 
     val adddouble : t -> cstr_t -> float -> float
     val addint : t -> cstr_t -> int -> int
+    val apply : t -> Write_batch.t -> unit
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> cstr_t -> cstr_t option
+    val fold_range :
+      t -> ?bkey:cstr_t -> ?binc:bool -> ?ekey:cstr_t -> ?einc:bool -> ?max:int -> ?chunk:int ->
+      (cstr_t -> 'a -> 'a) -> 'a -> 'a
+    val fold_range_pairs :
+      t -> ?bkey:cstr_t -> ?binc:bool -> ?ekey:cstr_t -> ?einc:bool -> ?max:int -> ?chunk:int ->
+      (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
     val fsiz : t -> int64
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val get : t -> cstr_t -> cstr_t
+    val get_into : t -> cstr_t -> Cstr.buf -> int
     val getlist : t -> cstr_t -> tclist_t
+    val opaque : t -> string
     val open_ : t -> ?omode:omode list -> string -> unit
     val optimize : t -> ?lmemb:int32 -> ?nmemb:int32 -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
     val out : t -> cstr_t -> unit
     val outlist : t -> cstr_t -> unit
     val path : t -> string
     val put : t -> cstr_t -> cstr_t -> unit
+    val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putcat : t -> cstr_t -> cstr_t -> unit
+    val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putdup : t -> cstr_t -> cstr_t -> unit
+    val putdup_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putkeep : t -> cstr_t -> cstr_t -> unit
+    val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putlist : t -> cstr_t -> tclist_t -> unit
     val range : t -> ?bkey:cstr_t -> ?binc:bool -> ?ekey:cstr_t -> ?einc:bool -> ?max:int -> unit -> tclist_t
+    val range_pairs :
+      t -> ?bkey:cstr_t -> ?binc:bool -> ?ekey:cstr_t -> ?einc:bool -> ?max:int -> unit -> (cstr_t * cstr_t) list
     val rnum : t -> int64
+    val separators : t -> int -> tclist_t
     val setcache : t -> ?lcnum:int32 -> ?ncnum:int32 -> unit -> unit
     val setcmpfunc : t -> cmpfunc -> unit
     val setdfunit : t -> int32 -> unit
+    val setopaque : t -> int -> string -> unit
     val setxmsiz : t -> int64 -> unit
     val sync : t -> unit
     val tranabort : t -> unit
@@ -220,8 +321,61 @@ struct
     external _addint : t -> string -> int -> int -> int = "otoky_bdb_addint"
     let addint t key num = _addint t (Cs.string key) (Cs.length key) num
 
+    external apply : t -> Write_batch.t -> unit = "otoky_bdb_apply"
+
     external close : t -> unit = "otoky_bdb_close"
     external copy : t -> string -> unit = "otoky_bdb_copy"
+
+    external _find : t -> string -> int -> Cstr.t option = "otoky_bdb_find"
+    let find t key =
+      match _find t (Cs.string key) (Cs.length key) with
+        | None -> None
+        | Some cstr ->
+            let r = Cs.of_cstr cstr in
+            if Cs.del then Cstr.del cstr;
+            Some r
+
+    type cur
+    external _cur_new : t -> cur = "otoky_bdbcur_new"
+    external _range_start : cur -> ?bkey:string -> blen:int -> ?binc:bool -> unit -> bool = "otoky_bdbcur_range_start"
+    external _range_keys : cur -> ?ekey:string -> elen:int -> ?einc:bool -> int -> Cstr.t array = "otoky_bdbcur_range"
+    external _range_pairs :
+      cur -> ?ekey:string -> elen:int -> ?einc:bool -> int -> (Cstr.t * Cstr.t) array = "otoky_bdbcur_range_pairs"
+
+    let conv_cstr cstr =
+      let r = Cs.of_cstr cstr in
+      if Cs.del then Cstr.del cstr;
+      r
+
+    (* walks a cursor, reading chunk records per call so memory stays bounded *)
+    let fold_chunks func read t ?bkey ?binc ?max ?(chunk = 1024) f a =
+      if chunk <= 0 then invalid_arg func;
+      let bkey, blen = match bkey with None -> None, -1 | Some key -> Some (Cs.string key), (Cs.length key) in
+      let cur = _cur_new t in
+      let rec loop a n =
+        let num = match max with Some max when max >= 0 && max - n < chunk -> max - n | _ -> chunk in
+        if num <= 0 then a
+        else
+          let items = read cur num in
+          let a = f items a in
+          let len = Array.length items in
+          if len < num then a else loop a (n + len) in
+      if _range_start cur ?bkey ~blen ?binc () then loop a 0 else a
+
+    let fold_range t ?bkey ?binc ?ekey ?einc ?max ?chunk f a =
+      let ekey, elen = match ekey with None -> None, -1 | Some key -> Some (Cs.string key), (Cs.length key) in
+      let read cur num = _range_keys cur ?ekey ~elen ?einc num in
+      fold_chunks "fold_range" read t ?bkey ?binc ?max ?chunk (fold_chunk conv_cstr Cstr.del f) a
+
+    let fold_range_pairs t ?bkey ?binc ?ekey ?einc ?max ?chunk f a =
+      let ekey, elen = match ekey with None -> None, -1 | Some key -> Some (Cs.string key), (Cs.length key) in
+      let read cur num = _range_pairs cur ?ekey ~elen ?einc num in
+      let conv (k, v) =
+        let k = conv_cstr k in
+        (k, conv_cstr v) in
+      let del (k, v) = Cstr.del k; Cstr.del v in
+      fold_chunks "fold_range_pairs" read t ?bkey ?binc ?max ?chunk (fold_chunk conv del (fun (k, v) a -> f k v a)) a
+
     external fsiz : t -> int64 = "otoky_bdb_fsiz"
 
     external _fwmkeys : t -> ?max:int -> string -> int -> Tclist.t = "otoky_bdb_fwmkeys"
@@ -238,6 +392,9 @@ struct
       if Cs.del then Cstr.del cstr;
       r
 
+    external _get_into : t -> string -> int -> Cstr.buf -> int = "otoky_bdb_get_into"
+    let get_into t key buf = _get_into t (Cs.string key) (Cs.length key) buf
+
     external _getlist : t -> string -> int -> Tclist.t = "otoky_bdb_getlist"
     let getlist t key =
       let tclist = _getlist t (Cs.string key) (Cs.length key) in
@@ -245,6 +402,7 @@ struct
       if Tcl.del then Tclist.del tclist;
       r
 
+    external opaque : t -> string = "otoky_bdb_opaque"
     external open_ : t -> ?omode:omode list -> string -> unit = "otoky_bdb_open"
     external optimize :
       t -> ?lmemb:int32 -> ?nmemb:int32 -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit =
@@ -261,15 +419,35 @@ struct
     external _put : t -> string -> int -> string -> int -> unit = "otoky_bdb_put"
     let put t key value = _put t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _put_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_bdb_put_ba_bc" "otoky_bdb_put_ba"
+    let put_ba t key buf off len =
+      Cstr.check_buf buf off len "put_ba";
+      _put_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putcat : t -> string -> int -> string -> int -> unit = "otoky_bdb_putcat"
     let putcat t key value = _putcat t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _putcat_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_bdb_putcat_ba_bc" "otoky_bdb_putcat_ba"
+    let putcat_ba t key buf off len =
+      Cstr.check_buf buf off len "putcat_ba";
+      _putcat_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putdup : t -> string -> int -> string -> int -> unit = "otoky_bdb_putdup"
     let putdup t key value = _putdup t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _putdup_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_bdb_putdup_ba_bc" "otoky_bdb_putdup_ba"
+    let putdup_ba t key buf off len =
+      Cstr.check_buf buf off len "putdup_ba";
+      _putdup_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putkeep : t -> string -> int -> string -> int -> unit = "otoky_bdb_putkeep"
     let putkeep t key value = _putkeep t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _putkeep_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_bdb_putkeep_ba_bc" "otoky_bdb_putkeep_ba"
+    let putkeep_ba t key buf off len =
+      Cstr.check_buf buf off len "putkeep_ba";
+      _putkeep_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putlist : t -> string -> int -> Tclist.t -> unit = "otoky_bdb_putlist"
     let putlist t key vals =
       if Tcl.del
@@ -294,10 +472,27 @@ struct
       if Tcl.del then Tclist.del tclist;
       r
 
+    let range_pairs t ?bkey ?binc ?ekey ?einc ?max () =
+      List.rev (fold_range_pairs t ?bkey ?binc ?ekey ?einc ?max (fun k v l -> (k, v) :: l) [])
+
     external rnum : t -> int64 = "otoky_bdb_rnum"
+
+    external _separators : t -> int -> Tclist.t = "otoky_bdb_separators"
+    let separators t num =
+      let tclist = _separators t num in
+      let r = Tcl.of_tclist tclist in
+      if Tcl.del then Tclist.del tclist;
+      r
+
     external setcache : t -> ?lcnum:int32 -> ?ncnum:int32 -> unit -> unit = "otoky_bdb_setcache"
     external setcmpfunc : t -> cmpfunc -> unit = "otoky_bdb_setcmpfunc"
     external setdfunit : t -> int32 -> unit = "otoky_bdb_setdfunit"
+
+    external _setopaque : t -> int -> string -> unit = "otoky_bdb_setopaque"
+    let setopaque t off s =
+      if off < 0 || off + String.length s > 64 then invalid_arg "setopaque";
+      _setopaque t off s
+
     external setxmsiz : t -> int64 -> unit = "otoky_bdb_setxmsiz"
 
     external sync : t -> unit = "otoky_bdb_sync"
@@ -336,9 +531,12 @@ struct
     val key : t -> cstr_t
     val last : t -> unit
     val next : t -> unit
+    val next_n : t -> int -> (cstr_t * cstr_t) array
     val out : t -> unit
     val prev : t -> unit
+    val prev_n : t -> int -> (cstr_t * cstr_t) array
     val put : t -> ?cpmode:cpmode -> cstr_t -> unit
+    val skip : t -> int -> int
     val val_ : t -> cstr_t
   end
 
@@ -362,12 +560,29 @@ struct
 
     external last : t -> unit = "otoky_bdbcur_last"
     external next : t -> unit = "otoky_bdbcur_next"
+
+    let of_pairs cstrs =
+      Array.map
+        (fun (k, v) ->
+           let r = (Cs.of_cstr k, Cs.of_cstr v) in
+           if Cs.del then begin Cstr.del k; Cstr.del v end;
+           r)
+        cstrs
+
+    external _next_n : t -> int -> (Cstr.t * Cstr.t) array = "otoky_bdbcur_next_n"
+    let next_n t num = of_pairs (_next_n t num)
+
     external out : t -> unit = "otoky_bdbcur_out"
     external prev : t -> unit = "otoky_bdbcur_prev"
 
+    external _prev_n : t -> int -> (Cstr.t * Cstr.t) array = "otoky_bdbcur_prev_n"
+    let prev_n t num = of_pairs (_prev_n t num)
+
     external _put : t -> ?cpmode:cpmode -> string -> int -> unit = "otoky_bdbcur_put"
     let put t ?cpmode val_ = _put t ?cpmode (Cs.string val_) (Cs.length val_)
 
+    external skip : t -> int -> int = "otoky_bdbcur_skip"
+
     external _val : t -> Cstr.t = "otoky_bdbcur_val"
     let val_ t =
       let cstr = _val t in
@@ -396,10 +611,15 @@ struct
 
     val adddouble : t -> int64 -> float -> float
     val addint : t -> int64 -> int -> int
+    val apply : t -> Write_batch.t -> unit
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> int64 -> cstr_t option
+    val fold : t -> ?chunk:int -> (int64 -> cstr_t -> 'a -> 'a) -> 'a -> 'a
     val fsiz : t -> int64
     val get : t -> int64 -> cstr_t
+    val get_into : t -> int64 -> Cstr.buf -> int
+    val iter : t -> ?chunk:int -> (int64 -> cstr_t -> unit) -> unit
     val iterinit : t -> unit
     val iternext : t -> int64
     val open_ : t -> ?omode:omode list -> string -> unit
@@ -407,9 +627,15 @@ struct
     val out : t -> int64 -> unit
     val path : t -> string
     val put : t -> int64 -> cstr_t -> unit
+    val put_ba : t -> int64 -> Cstr.buf -> int -> int -> unit
     val putcat : t -> int64 -> cstr_t -> unit
+    val putcat_ba : t -> int64 -> Cstr.buf -> int -> int -> unit
     val putkeep : t -> int64 -> cstr_t -> unit
+    val putkeep_ba : t -> int64 -> Cstr.buf -> int -> int -> unit
     val range : t -> ?lower:int64 -> ?upper:int64 -> ?max:int -> unit -> int64 array
+    val range_ba :
+      t -> ?lower:int64 -> ?upper:int64 -> ?max:int -> unit ->
+      (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array1.t
     val rnum : t -> int64
     val sync : t -> unit
     val tranabort : t -> unit
@@ -431,8 +657,20 @@ struct
     external adddouble : t -> int64 -> float -> float = "otoky_fdb_adddouble"
     external addint : t -> int64 -> int -> int = "otoky_fdb_addint"
 
+    external apply : t -> Write_batch.t -> unit = "otoky_fdb_apply"
+
     external close : t -> unit = "otoky_fdb_close"
     external copy : t -> string -> unit = "otoky_fdb_copy"
+
+    external _find : t -> int64 -> Cstr.t option = "otoky_fdb_find"
+    let find t key =
+      match _find t key with
+        | None -> None
+        | Some cstr ->
+            let r = Cs.of_cstr cstr in
+            if Cs.del then Cstr.del cstr;
+            Some r
+
     external fsiz : t -> int64 = "otoky_fdb_fsiz"
 
     external _get : t -> int64 -> Cstr.t = "otoky_fdb_get"
@@ -442,8 +680,31 @@ struct
       if Cs.del then Cstr.del cstr;
       r
 
+    external get_into : t -> int64 -> Cstr.buf -> int = "otoky_fdb_get_into"
+
     external iterinit : t -> unit = "otoky_fdb_iterinit"
     external iternext : t -> int64 = "otoky_fdb_iternext"
+
+    external _iter_pairs : t -> int64 -> int -> (int64 * Cstr.t) array = "otoky_fdb_iter_pairs"
+
+    (* reads chunk records per call, resuming after the last id seen *)
+    let fold t ?(chunk = 1024) f a =
+      if chunk <= 0 then invalid_arg "fold";
+      let conv (k, v) =
+        let r = Cs.of_cstr v in
+        if Cs.del then Cstr.del v;
+        (k, r) in
+      let del (_, v) = Cstr.del v in
+      let rec loop a lower =
+        let items = _iter_pairs t lower chunk in
+        let len = Array.length items in
+        if len = 0 then a
+        else
+          let a = fold_chunk conv del (fun (k, v) a -> f k v a) items a in
+          loop a (Int64.succ (fst items.(len - 1))) in
+      loop a 1L
+
+    let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
     external open_ : t -> ?omode:omode list -> string -> unit = "otoky_fdb_open"
     external optimize : t -> ?width:int32 -> ?limsiz:int64 -> unit -> unit = "otoky_fdb_optimize"
     external out : t -> int64 -> unit = "otoky_fdb_out"
@@ -452,13 +713,31 @@ struct
     external _put : t -> int64 -> string -> int -> unit = "otoky_fdb_put"
     let put t key value = _put t key (Cs.string value) (Cs.length value)
 
+    external _put_ba : t -> int64 -> Cstr.buf -> int -> int -> unit = "otoky_fdb_put_ba"
+    let put_ba t key buf off len =
+      Cstr.check_buf buf off len "put_ba";
+      _put_ba t key buf off len
+
     external _putcat : t -> int64 -> string -> int -> unit = "otoky_fdb_putcat"
     let putcat t key value = _putcat t key (Cs.string value) (Cs.length value)
 
+    external _putcat_ba : t -> int64 -> Cstr.buf -> int -> int -> unit = "otoky_fdb_putcat_ba"
+    let putcat_ba t key buf off len =
+      Cstr.check_buf buf off len "putcat_ba";
+      _putcat_ba t key buf off len
+
     external _putkeep : t -> int64 -> string -> int -> unit = "otoky_fdb_putkeep"
     let putkeep t key value = _putkeep t key (Cs.string value) (Cs.length value)
 
+    external _putkeep_ba : t -> int64 -> Cstr.buf -> int -> int -> unit = "otoky_fdb_putkeep_ba"
+    let putkeep_ba t key buf off len =
+      Cstr.check_buf buf off len "putkeep_ba";
+      _putkeep_ba t key buf off len
+
     external range : t -> ?lower:int64 -> ?upper:int64 -> ?max:int -> unit -> int64 array = "otoky_fdb_range"
+    external range_ba :
+      t -> ?lower:int64 -> ?upper:int64 -> ?max:int -> unit ->
+      (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array1.t = "otoky_fdb_range_ba"
     external rnum : t -> int64 = "otoky_fdb_rnum"
     external sync : t -> unit = "otoky_fdb_sync"
     external tranabort : t -> unit = "otoky_fdb_tranabort"
@@ -487,24 +766,37 @@ struct
 
     val adddouble : t -> cstr_t -> float -> float
     val addint : t -> cstr_t -> int -> int
+    val apply : t -> Write_batch.t -> unit
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> cstr_t -> cstr_t option
+    val fold : t -> ?chunk:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
+    val fold_slice : t -> ?chunk:int -> int64 * int64 -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
     val fsiz : t -> int64
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val get : t -> cstr_t -> cstr_t
+    val get_into : t -> cstr_t -> Cstr.buf -> int
+    val iter : t -> ?chunk:int -> (cstr_t -> cstr_t -> unit) -> unit
     val iterinit : t -> unit
     val iternext : t -> cstr_t
+    val mget : t -> cstr_t array -> cstr_t option array
+    val opaque : t -> string
     val open_ : t -> ?omode:omode list -> string -> unit
     val optimize : t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
     val out : t -> cstr_t -> unit
+    val partition : t -> int -> (int64 * int64) array
     val path : t -> string
     val put : t -> cstr_t -> cstr_t -> unit
+    val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putasync : t -> cstr_t -> cstr_t -> unit
     val putcat : t -> cstr_t -> cstr_t -> unit
+    val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putkeep : t -> cstr_t -> cstr_t -> unit
+    val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val rnum : t -> int64
     val setcache : t -> int32 -> unit
     val setdfunit : t -> int32 -> unit
+    val setopaque : t -> int -> string -> unit
     val setxmsiz : t -> int64 -> unit
     val sync : t -> unit
     val tranabort : t -> unit
@@ -528,8 +820,20 @@ struct
     external _addint : t -> string -> int -> int -> int = "otoky_hdb_addint"
     let addint t key num = _addint t (Cs.string key) (Cs.length key) num
 
+    external apply : t -> Write_batch.t -> unit = "otoky_hdb_apply"
+
     external close : t -> unit = "otoky_hdb_close"
     external copy : t -> string -> unit = "otoky_hdb_copy"
+
+    external _find : t -> string -> int -> Cstr.t option = "otoky_hdb_find"
+    let find t key =
+      match _find t (Cs.string key) (Cs.length key) with
+        | None -> None
+        | Some cstr ->
+            let r = Cs.of_cstr cstr in
+            if Cs.del then Cstr.del cstr;
+            Some r
+
     external fsiz : t -> int64 = "otoky_hdb_fsiz"
 
     external _fwmkeys : t -> ?max:int -> string -> int -> Tclist.t = "otoky_hdb_fwmkeys"
@@ -546,6 +850,9 @@ struct
       if Cs.del then Cstr.del cstr;
       r
 
+    external _get_into : t -> string -> int -> Cstr.buf -> int = "otoky_hdb_get_into"
+    let get_into t key buf = _get_into t (Cs.string key) (Cs.length key) buf
+
     external iterinit : t -> unit = "otoky_hdb_iterinit"
 
     external _iternext : t -> Cstr.t = "otoky_hdb_iternext"
@@ -555,6 +862,52 @@ struct
       if Cs.del then Cstr.del cstr;
       r
 
+    external _iter_pairs : t -> int -> (Cstr.t * Cstr.t) array = "otoky_hdb_iter_pairs"
+
+    let conv_pair (k, v) =
+      let k' = Cs.of_cstr k in
+      if Cs.del then Cstr.del k;
+      let v' = Cs.of_cstr v in
+      if Cs.del then Cstr.del v;
+      (k', v')
+
+    let del_pair (k, v) = Cstr.del k; Cstr.del v
+
+    let fold_pairs read chunk f a =
+      let rec loop a =
+        let items = read chunk in
+        let a = fold_chunk conv_pair del_pair (fun (k, v) a -> f k v a) items a in
+        if Array.length items < chunk then a else loop a in
+      loop a
+
+    (* restarts the iterator, reading chunk records per call *)
+    let fold t ?(chunk = 1024) f a =
+      if chunk <= 0 then invalid_arg "fold";
+      iterinit t;
+      fold_pairs (_iter_pairs t) chunk f a
+
+    external _slice_pairs : t -> int64 ref -> int64 -> int -> (Cstr.t * Cstr.t) array = "otoky_hdb_slice_pairs"
+
+    (* reads the slice with its own cursor through t; chunk reads take turns with other iteration on t *)
+    let fold_slice t ?(chunk = 1024) (start, end_) f a =
+      if chunk <= 0 then invalid_arg "fold_slice";
+      fold_pairs (_slice_pairs t (ref start) end_) chunk f a
+
+    let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
+
+    external _mget : t -> Cstr.t array -> Cstr.t option array = "otoky_hdb_mget"
+    let mget t keys =
+      let cstrs = _mget t (Array.map Cs.to_cstr keys) in
+      Array.map
+        (function
+           | None -> None
+           | Some cstr ->
+               let r = Cs.of_cstr cstr in
+               if Cs.del then Cstr.del cstr;
+               Some r)
+        cstrs
+
+    external opaque : t -> string = "otoky_hdb_opaque"
     external open_ : t -> ?omode:omode list -> string -> unit = "otoky_hdb_open"
     external optimize :
       t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit =
@@ -563,24 +916,53 @@ struct
     external _out : t -> string -> int -> unit = "otoky_hdb_out"
     let out t key = _out t (Cs.string key) (Cs.length key)
 
+    external _partition : t -> int -> int64 array = "otoky_hdb_partition"
+    let partition t num =
+      if num <= 0 then invalid_arg "partition";
+      let bounds = _partition t num in
+      let len = Array.length bounds - 1 in
+      (* the last slice is open-ended, to take records appended since *)
+      Array.init len (fun i -> (bounds.(i), if i = len - 1 then Int64.max_int else bounds.(i + 1)))
+
     external path : t -> string = "otoky_hdb_path"
 
     external _put : t -> string -> int -> string -> int -> unit = "otoky_hdb_put"
     let put t key value = _put t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _put_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_hdb_put_ba_bc" "otoky_hdb_put_ba"
+    let put_ba t key buf off len =
+      Cstr.check_buf buf off len "put_ba";
+      _put_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putasync : t -> string -> int -> string -> int -> unit = "otoky_hdb_putasync"
     let putasync t key value = _putasync t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
     external _putcat : t -> string -> int -> string -> int -> unit = "otoky_hdb_putcat"
     let putcat t key value = _putcat t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _putcat_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_hdb_putcat_ba_bc" "otoky_hdb_putcat_ba"
+    let putcat_ba t key buf off len =
+      Cstr.check_buf buf off len "putcat_ba";
+      _putcat_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putkeep : t -> string -> int -> string -> int -> unit = "otoky_hdb_putkeep"
     let putkeep t key value = _putkeep t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _putkeep_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_hdb_putkeep_ba_bc" "otoky_hdb_putkeep_ba"
+    let putkeep_ba t key buf off len =
+      Cstr.check_buf buf off len "putkeep_ba";
+      _putkeep_ba t (Cs.string key) (Cs.length key) buf off len
+
     external rnum : t -> int64 = "otoky_hdb_rnum"
 
     external setcache : t -> int32 -> unit = "otoky_hdb_setcache"
     external setdfunit : t -> int32 -> unit = "otoky_hdb_setdfunit"
+
+    external _setopaque : t -> int -> string -> unit = "otoky_hdb_setopaque"
+    let setopaque t off s =
+      if off < 0 || off + String.length s > 128 then invalid_arg "setopaque";
+      _setopaque t off s
+
     external setxmsiz : t -> int64 -> unit = "otoky_hdb_setxmsiz"
 
     external sync : t -> unit = "otoky_hdb_sync"
@@ -599,6 +981,148 @@ struct
   include Fun (Cstr_string) (Tclist_list)
 end
 
+(*
+  one logical hash database split across n HDB files (fn.0 .. fn.n-1)
+  by a hash of the key, so writers to different shards don't contend
+  for one lock. tuning applies to every shard.
+*)
+module Sharded_hdb =
+struct
+  type t = HDB.t array
+
+  module type Sig =
+  sig
+    type cstr_t
+
+    val new_ : int -> t
+
+    val apply : t -> Write_batch.t array -> unit
+    val close : t -> unit
+    val find : t -> cstr_t -> cstr_t option
+    val fold : t -> ?chunk:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
+    val fsiz : t -> int64
+    val get : t -> cstr_t -> cstr_t
+    val iter : t -> ?chunk:int -> (cstr_t -> cstr_t -> unit) -> unit
+    val mget : t -> cstr_t array -> cstr_t option array
+    val open_ : t -> ?omode:omode list -> string -> unit
+    val optimize : t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
+    val out : t -> cstr_t -> unit
+    val put : t -> cstr_t -> cstr_t -> unit
+    val putasync : t -> cstr_t -> cstr_t -> unit
+    val putcat : t -> cstr_t -> cstr_t -> unit
+    val putkeep : t -> cstr_t -> cstr_t -> unit
+    val rnum : t -> int64
+    val setcache : t -> int32 -> unit
+    val setdfunit : t -> int32 -> unit
+    val setxmsiz : t -> int64 -> unit
+    val shard : t -> cstr_t -> int
+    val shards : t -> HDB.t array
+    val sync : t -> unit
+    val tune : t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
+    val vanish : t -> unit
+    val vsiz : t -> cstr_t -> int
+    val write_batch : t -> Write_batch.t array
+  end
+
+  module Fun (Cs : Cstr_t) =
+  struct
+    type cstr_t = Cs.t
+
+    module H = HDB.Fun (Cs) (Tclist_tclist)
+
+    let new_ n =
+      if n <= 0 then invalid_arg "new_";
+      Array.init n (fun _ -> HDB.new_ ())
+
+    (* FNV-1a truncated to 30 bits, so a key maps to the same shard on every platform *)
+    let shard t key = Cstr.hash (Cs.string key, Cs.length key) mod Array.length t
+
+    let apply t wbs =
+      if Array.length wbs <> Array.length t then invalid_arg "apply";
+      (* each shard's batch is applied in its own transaction *)
+      Array.iteri (fun i wb -> if Write_batch.num wb > 0 then HDB.apply t.(i) wb) wbs
+
+    let close t = Array.iter HDB.close t
+
+    let find t key = H.find t.(shard t key) key
+
+    let fold t ?chunk f a = Array.fold_left (fun a hdb -> H.fold hdb ?chunk f a) a t
+
+    let sum f t = Array.fold_left (fun n hdb -> Int64.add n (f hdb)) 0L t
+
+    let fsiz t = sum HDB.fsiz t
+
+    let get t key = H.get t.(shard t key) key
+
+    let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
+
+    let mget t keys =
+      let r = Array.make (Array.length keys) None in
+      let idx = Array.map (shard t) keys in
+      for s = 0 to Array.length t - 1 do
+        let is = ref [] in
+        for i = Array.length keys - 1 downto 0 do
+          if idx.(i) = s then is := i :: !is
+        done;
+        if !is <> [] then begin
+          let is = Array.of_list !is in
+          let vs = H.mget t.(s) (Array.map (fun i -> keys.(i)) is) in
+          Array.iteri (fun j i -> r.(i) <- vs.(j)) is
+        end
+      done;
+      r
+
+    (* bytes 120-127 of each shard's opaque header record the shard count and index *)
+    let tag_off = 120
+
+    let open_ t ?omode fn =
+      let n = Array.length t in
+      let writer = match omode with Some omode -> List.mem Owriter omode | None -> false in
+      let opened = ref 0 in
+      try
+        Array.iteri
+          (fun i hdb ->
+             HDB.open_ hdb ?omode (Printf.sprintf "%s.%d" fn i);
+             incr opened;
+             let tag = Printf.sprintf "%04x%04x" n i in
+             let cur = String.sub (HDB.opaque hdb) tag_off (String.length tag) in
+             if cur = String.make (String.length tag) '\000'
+             then (if writer then HDB.setopaque hdb tag_off tag)
+             else if cur <> tag
+             then raise (Error (Einvalid, "open_", "shard count mismatch")))
+          t
+      with e ->
+        for i = 0 to !opened - 1 do
+          try HDB.close t.(i) with _ -> ()
+        done;
+        raise e
+
+    let optimize t ?bnum ?apow ?fpow ?opts () =
+      Array.iter (fun hdb -> HDB.optimize hdb ?bnum ?apow ?fpow ?opts ()) t
+
+    let out t key = H.out t.(shard t key) key
+    let put t key value = H.put t.(shard t key) key value
+    let putasync t key value = H.putasync t.(shard t key) key value
+    let putcat t key value = H.putcat t.(shard t key) key value
+    let putkeep t key value = H.putkeep t.(shard t key) key value
+    let rnum t = sum HDB.rnum t
+    let setcache t rcnum = Array.iter (fun hdb -> HDB.setcache hdb rcnum) t
+    let setdfunit t dfunit = Array.iter (fun hdb -> HDB.setdfunit hdb dfunit) t
+    let setxmsiz t xmsiz = Array.iter (fun hdb -> HDB.setxmsiz hdb xmsiz) t
+    let shards t = Array.copy t
+    let sync t = Array.iter HDB.sync t
+
+    let tune t ?bnum ?apow ?fpow ?opts () =
+      Array.iter (fun hdb -> HDB.tune hdb ?bnum ?apow ?fpow ?opts ()) t
+
+    let vanish t = Array.iter HDB.vanish t
+    let vsiz t key = H.vsiz t.(shard t key) key
+    let write_batch t = Array.init (Array.length t) (fun _ -> Write_batch.new_ ())
+  end
+
+  include Fun (Cstr_string)
+end
+
 module TDB =
 struct
   type itype = It_lexical | It_decimal | It_token | It_qgram | It_opt | It_void
@@ -617,10 +1141,13 @@ struct
     val addint : t -> cstr_t -> int -> int
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> cstr_t -> tcmap_t option
+    val fold : t -> ?chunk:int -> (cstr_t -> tcmap_t -> 'a -> 'a) -> 'a -> 'a
     val fsiz : t -> int64
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val genuid : t -> int64
     val get : t -> cstr_t -> tcmap_t
+    val iter : t -> ?chunk:int -> (cstr_t -> tcmap_t -> unit) -> unit
     val iterinit : t -> unit
     val iternext : t -> cstr_t
     val open_ : t -> ?omode:omode list -> string -> unit
@@ -660,6 +1187,16 @@ struct
 
     external close : t -> unit = "otoky_tdb_close"
     external copy : t -> string -> unit = "otoky_tdb_copy"
+
+    external _find : t -> string -> int -> Tcmap.t option = "otoky_tdb_find"
+    let find t key =
+      match _find t (Cs.string key) (Cs.length key) with
+        | None -> None
+        | Some tcmap ->
+            let r = Tcm.of_tcmap tcmap in
+            if Tcm.del then Tcmap.del tcmap;
+            Some r
+
     external fsiz : t -> int64 = "otoky_tdb_fsiz"
 
     external _fwmkeys : t -> ?max:int -> string -> int -> Tclist.t = "otoky_tdb_fwmkeys"
@@ -687,6 +1224,27 @@ struct
       if Cs.del then Cstr.del cstr;
       r
 
+    external _iter_pairs : t -> int -> (Cstr.t * Tcmap.t) array = "otoky_tdb_iter_pairs"
+
+    (* restarts the iterator, reading chunk records per call *)
+    let fold t ?(chunk = 1024) f a =
+      if chunk <= 0 then invalid_arg "fold";
+      let conv (k, cols) =
+        let k' = Cs.of_cstr k in
+        if Cs.del then Cstr.del k;
+        let cols' = Tcm.of_tcmap cols in
+        if Tcm.del then Tcmap.del cols;
+        (k', cols') in
+      let del (k, cols) = Cstr.del k; Tcmap.del cols in
+      iterinit t;
+      let rec loop a =
+        let items = _iter_pairs t chunk in
+        if Array.length items = 0 then a
+        else loop (fold_chunk conv del (fun (k, cols) a -> f k cols a) items a) in
+      loop a
+
+    let iter t ?chunk f = fold t ?chunk (fun k cols () -> f k cols) ()
+
     external open_ : t -> ?omode:omode list -> string -> unit = "otoky_tdb_open"
 
     external optimize :
@@ -33,6 +33,32 @@ type omode = Oreader | Owriter | Ocreat | Otrunc | Onolck | Olcknb | Otsync
 
 type opt = Tlarge | Tdeflate | Tbzip | Ttcbs
 
+module Write_batch :
+sig
+  type t
+
+  module type Sig =
+  sig
+    type cstr_t
+
+    val new_ : unit -> t
+
+    val clear : t -> unit
+    val num : t -> int
+    val out : t -> cstr_t -> unit
+    val out_id : t -> int64 -> unit
+    val put : t -> cstr_t -> cstr_t -> unit
+    val put_id : t -> int64 -> cstr_t -> unit
+    val putcat : t -> cstr_t -> cstr_t -> unit
+    val putcat_id : t -> int64 -> cstr_t -> unit
+    val putkeep : t -> cstr_t -> cstr_t -> unit
+    val putkeep_id : t -> int64 -> cstr_t -> unit
+  end
+
+  include Sig with type cstr_t = string
+  module Fun (Cs : Cstr_t) : Sig with type cstr_t = Cs.t
+end
+
 module ADB :
 sig
   type t
@@ -48,6 +74,7 @@ sig
     val addint : t -> cstr_t -> int -> int
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> cstr_t -> cstr_t option
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val get : t -> cstr_t -> cstr_t
     val iterinit : t -> unit
@@ -77,9 +104,12 @@ end
 
 module BDB :
 sig
+  type cmpfield = Cf_int32 | Cf_int64 | Cf_string
+
   type cmpfunc =
       | Cmp_lexical | Cmp_decimal | Cmp_int32 | Cmp_int64
       | Cmp_custom of (string -> string -> int) | Cmp_custom_cstr of (string -> int -> string -> int -> int)
+      | Cmp_fields of cmpfield list
 
   type t
 
@@ -92,27 +122,45 @@ sig
 
     val adddouble : t -> cstr_t -> float -> float
     val addint : t -> cstr_t -> int -> int
+    val apply : t -> Write_batch.t -> unit
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> cstr_t -> cstr_t option
+    val fold_range :
+      t -> ?bkey:cstr_t -> ?binc:bool -> ?ekey:cstr_t -> ?einc:bool -> ?max:int -> ?chunk:int ->
+      (cstr_t -> 'a -> 'a) -> 'a -> 'a
+    val fold_range_pairs :
+      t -> ?bkey:cstr_t -> ?binc:bool -> ?ekey:cstr_t -> ?einc:bool -> ?max:int -> ?chunk:int ->
+      (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
     val fsiz : t -> int64
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val get : t -> cstr_t -> cstr_t
+    val get_into : t -> cstr_t -> Cstr.buf -> int
     val getlist : t -> cstr_t -> tclist_t
+    val opaque : t -> string
     val open_ : t -> ?omode:omode list -> string -> unit
     val optimize : t -> ?lmemb:int32 -> ?nmemb:int32 -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
     val out : t -> cstr_t -> unit
     val outlist : t -> cstr_t -> unit
     val path : t -> string
     val put : t -> cstr_t -> cstr_t -> unit
+    val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putcat : t -> cstr_t -> cstr_t -> unit
+    val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putdup : t -> cstr_t -> cstr_t -> unit
+    val putdup_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putkeep : t -> cstr_t -> cstr_t -> unit
+    val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putlist : t -> cstr_t -> tclist_t -> unit
     val range : t -> ?bkey:cstr_t -> ?binc:bool -> ?ekey:cstr_t -> ?einc:bool -> ?max:int -> unit -> tclist_t
+    val range_pairs :
+      t -> ?bkey:cstr_t -> ?binc:bool -> ?ekey:cstr_t -> ?einc:bool -> ?max:int -> unit -> (cstr_t * cstr_t) list
     val rnum : t -> int64
+    val separators : t -> int -> tclist_t
     val setcache : t -> ?lcnum:int32 -> ?ncnum:int32 -> unit -> unit
     val setcmpfunc : t -> cmpfunc -> unit
     val setdfunit : t -> int32 -> unit
+    val setopaque : t -> int -> string -> unit
     val setxmsiz : t -> int64 -> unit
     val sync : t -> unit
     val tranabort : t -> unit
@@ -124,6 +172,12 @@ sig
     val vsiz : t -> cstr_t -> int
   end
 
+  (*
+    separators t num: ascending keys splitting the tree into subtrees
+    of about equal size, from the root node and, if it has fewer than
+    num, the level below. reads no leaves, and only nodes as last
+    written to the file, so a tree not yet synced may give few or none.
+  *)
   include Sig with type cstr_t = string and type tclist_t = string list
 
   module Fun (Cs : Cstr_t) (Tcl : Tclist_t) : Sig with type cstr_t = Cs.t and type tclist_t = Tcl.t
@@ -146,9 +200,12 @@ sig
     val key : t -> cstr_t
     val last : t -> unit
     val next : t -> unit
+    val next_n : t -> int -> (cstr_t * cstr_t) array
     val out : t -> unit
     val prev : t -> unit
+    val prev_n : t -> int -> (cstr_t * cstr_t) array
     val put : t -> ?cpmode:cpmode -> cstr_t -> unit
+    val skip : t -> int -> int
     val val_ : t -> cstr_t
   end
 
@@ -174,10 +231,15 @@ sig
 
     val adddouble : t -> int64 -> float -> float
     val addint : t -> int64 -> int -> int
+    val apply : t -> Write_batch.t -> unit
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> int64 -> cstr_t option
+    val fold : t -> ?chunk:int -> (int64 -> cstr_t -> 'a -> 'a) -> 'a -> 'a
     val fsiz : t -> int64
     val get : t -> int64 -> cstr_t
+    val get_into : t -> int64 -> Cstr.buf -> int
+    val iter : t -> ?chunk:int -> (int64 -> cstr_t -> unit) -> unit
     val iterinit : t -> unit
     val iternext : t -> int64
     val open_ : t -> ?omode:omode list -> string -> unit
@@ -185,9 +247,15 @@ sig
     val out : t -> int64 -> unit
     val path : t -> string
     val put : t -> int64 -> cstr_t -> unit
+    val put_ba : t -> int64 -> Cstr.buf -> int -> int -> unit
     val putcat : t -> int64 -> cstr_t -> unit
+    val putcat_ba : t -> int64 -> Cstr.buf -> int -> int -> unit
     val putkeep : t -> int64 -> cstr_t -> unit
+    val putkeep_ba : t -> int64 -> Cstr.buf -> int -> int -> unit
     val range : t -> ?lower:int64 -> ?upper:int64 -> ?max:int -> unit -> int64 array
+    val range_ba :
+      t -> ?lower:int64 -> ?upper:int64 -> ?max:int -> unit ->
+      (int64, Bigarray.int64_elt, Bigarray.c_layout) Bigarray.Array1.t
     val rnum : t -> int64
     val sync : t -> unit
     val tranabort : t -> unit
@@ -218,24 +286,37 @@ sig
 
     val adddouble : t -> cstr_t -> float -> float
     val addint : t -> cstr_t -> int -> int
+    val apply : t -> Write_batch.t -> unit
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> cstr_t -> cstr_t option
+    val fold : t -> ?chunk:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
+    val fold_slice : t -> ?chunk:int -> int64 * int64 -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
     val fsiz : t -> int64
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val get : t -> cstr_t -> cstr_t
+    val get_into : t -> cstr_t -> Cstr.buf -> int
+    val iter : t -> ?chunk:int -> (cstr_t -> cstr_t -> unit) -> unit
     val iterinit : t -> unit
     val iternext : t -> cstr_t
+    val mget : t -> cstr_t array -> cstr_t option array
+    val opaque : t -> string
     val open_ : t -> ?omode:omode list -> string -> unit
     val optimize : t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
     val out : t -> cstr_t -> unit
+    val partition : t -> int -> (int64 * int64) array
     val path : t -> string
     val put : t -> cstr_t -> cstr_t -> unit
+    val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putasync : t -> cstr_t -> cstr_t -> unit
     val putcat : t -> cstr_t -> cstr_t -> unit
+    val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putkeep : t -> cstr_t -> cstr_t -> unit
+    val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val rnum : t -> int64
     val setcache : t -> int32 -> unit
     val setdfunit : t -> int32 -> unit
+    val setopaque : t -> int -> string -> unit
     val setxmsiz : t -> int64 -> unit
     val sync : t -> unit
     val tranabort : t -> unit
@@ -251,6 +332,49 @@ sig
   module Fun (Cs : Cstr_t) (Tcl : Tclist_t) : Sig with type cstr_t = Cs.t and type tclist_t = Tcl.t
 end
 
+module Sharded_hdb :
+sig
+  type t
+
+  module type Sig =
+  sig
+    type cstr_t
+
+    val new_ : int -> t
+
+    val apply : t -> Write_batch.t array -> unit
+    val close : t -> unit
+    val find : t -> cstr_t -> cstr_t option
+    val fold : t -> ?chunk:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
+    val fsiz : t -> int64
+    val get : t -> cstr_t -> cstr_t
+    val iter : t -> ?chunk:int -> (cstr_t -> cstr_t -> unit) -> unit
+    val mget : t -> cstr_t array -> cstr_t option array
+    val open_ : t -> ?omode:omode list -> string -> unit
+    val optimize : t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
+    val out : t -> cstr_t -> unit
+    val put : t -> cstr_t -> cstr_t -> unit
+    val putasync : t -> cstr_t -> cstr_t -> unit
+    val putcat : t -> cstr_t -> cstr_t -> unit
+    val putkeep : t -> cstr_t -> cstr_t -> unit
+    val rnum : t -> int64
+    val setcache : t -> int32 -> unit
+    val setdfunit : t -> int32 -> unit
+    val setxmsiz : t -> int64 -> unit
+    val shard : t -> cstr_t -> int
+    val shards : t -> HDB.t array
+    val sync : t -> unit
+    val tune : t -> ?bnum:int64 -> ?apow:int -> ?fpow:int -> ?opts:opt list -> unit -> unit
+    val vanish : t -> unit
+    val vsiz : t -> cstr_t -> int
+    val write_batch : t -> Write_batch.t array
+  end
+
+  include Sig with type cstr_t = string
+
+  module Fun (Cs : Cstr_t) : Sig with type cstr_t = Cs.t
+end
+
 module TDB :
 sig
   type itype = It_lexical | It_decimal | It_token | It_qgram | It_opt | It_void
@@ -269,10 +393,13 @@ sig
     val addint : t -> cstr_t -> int -> int
     val close : t -> unit
     val copy : t -> string -> unit
+    val find : t -> cstr_t -> tcmap_t option
+    val fold : t -> ?chunk:int -> (cstr_t -> tcmap_t -> 'a -> 'a) -> 'a -> 'a
     val fsiz : t -> int64
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val genuid : t -> int64
     val get : t -> cstr_t -> tcmap_t
+    val iter : t -> ?chunk:int -> (cstr_t -> tcmap_t -> unit) -> unit
     val iterinit : t -> unit
     val iternext : t -> cstr_t
     val open_ : t -> ?omode:omode list -> string -> unit
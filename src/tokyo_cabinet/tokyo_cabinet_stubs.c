@@ -1,5 +1,8 @@
 #include <string.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <caml/mlvalues.h>
 #include <caml/alloc.h>
@@ -7,6 +10,7 @@
 #include <caml/fail.h>
 #include <caml/memory.h>
 #include <caml/signals.h>
+#include <caml/bigarray.h>
 
 #include <tcadb.h>
 
@@ -25,6 +29,51 @@ static value copy_string_length(const void *s, int len)
   return res;
 }
 
+/*
+  OCaml values may move once the runtime lock is released, so
+  arguments used inside a blocking section are copied out first.
+  Short ones (the common case for keys) go on the stack.
+*/
+#define SCRATCH_SIZ 256
+
+/* size of the opaque regions returned by tchdbopaque and tcbdbopaque */
+#define HDB_OPAQUE_SIZ 128
+#define BDB_OPAQUE_SIZ 64
+
+typedef struct scratch {
+  char *ptr;
+  char buf[SCRATCH_SIZ];
+} scratch;
+
+static void scratch_copy(scratch *s, value vstr, int len)
+{
+  s->ptr = (len <= SCRATCH_SIZ) ? s->buf : tcmalloc(len);
+  memcpy(s->ptr, String_val(vstr), len);
+}
+
+/* includes the trailing NUL */
+static void scratch_copy_string(scratch *s, value vstr)
+{
+  scratch_copy(s, vstr, caml_string_length(vstr) + 1);
+}
+
+static void scratch_copy_option(scratch *s, value vopt, int len)
+{
+  if (vopt == Val_int(0)) s->ptr = NULL;
+  else scratch_copy(s, Field(vopt, 0), len);
+}
+
+static void scratch_copy_string_option(scratch *s, value vopt)
+{
+  if (vopt == Val_int(0)) s->ptr = NULL;
+  else scratch_copy_string(s, Field(vopt, 0));
+}
+
+static void scratch_free(scratch *s)
+{
+  if (s->ptr && s->ptr != s->buf) tcfree(s->ptr);
+}
+
 
 
 enum error {
@@ -111,6 +160,55 @@ static value make_cstr(const void *string, int len)
   return vpair;
 }
 
+static value make_cstr_option(const void *string, int len)
+{
+  CAMLparam0();
+  CAMLlocal2(vcstr, vsome);
+  vcstr = make_cstr(string, len);
+  vsome = caml_alloc_small(1, 0);
+  Field(vsome, 0) = vcstr;
+  CAMLreturn(vsome);
+}
+
+/* an array of (Cstr.t * Cstr.t) from alternating key and value buffers */
+static value make_cstr_pairs(int n, void **bufs, int *sizs)
+{
+  CAMLparam0();
+  CAMLlocal4(vrecs, vkey, vval, vpair);
+  int i;
+  if (n == 0) CAMLreturn(Atom(0));
+  vrecs = caml_alloc(n, 0);
+  for (i = 0; i < n; i++) {
+    vkey = make_cstr(bufs[2 * i], sizs[2 * i]);
+    vval = make_cstr(bufs[2 * i + 1], sizs[2 * i + 1]);
+    vpair = caml_alloc_tuple(2);
+    Store_field(vpair, 0, vkey);
+    Store_field(vpair, 1, vval);
+    Store_field(vrecs, i, vpair);
+  }
+  CAMLreturn(vrecs);
+}
+
+/* NULL if a size is negative or the total doesn't fit in an int */
+static char *copy_cstr_array(value vcstrs, int num, int *sizs)
+{
+  char *buf, *p;
+  int i;
+  size_t size = 0;
+  for (i = 0; i < num; i++) {
+    intnat siz = Long_val(Field(Field(vcstrs, i), 1));
+    if (siz < 0 || (size_t)siz > INT_MAX - size) return NULL;
+    sizs[i] = siz;
+    size += siz;
+  }
+  buf = p = tcmalloc(size + 1);
+  for (i = 0; i < num; i++) {
+    memcpy(p, String_val(Field(Field(vcstrs, i), 0)), sizs[i]);
+    p += sizs[i];
+  }
+  return buf;
+}
+
 enum omode {
   Oreader, Owriter, Ocreat, Otrunc, Onolck, Olcknb, Otsync
 };
@@ -162,6 +260,152 @@ static int opt_int_of_list(value v)
 
 
 
+typedef struct wb_wrap {
+  TCXSTR *xstr;
+  int num;
+} wb_wrap;
+
+#define wb_wrap_val(v) (*((wb_wrap **)(Data_custom_val(v))))
+
+enum wbop {
+  Wbput, Wbputkeep, Wbputcat, Wbout
+};
+
+/* set on ops whose key is an FDB id rather than a string */
+#define WBID 0x10
+
+/* a batch is a sequence of records: header, key, value */
+typedef struct wb_head {
+  int op;
+  int ksiz;
+  int vsiz;
+} wb_head;
+
+typedef bool (*wb_apply_fn)(void *db, const wb_head *head, const char *kbuf, const char *vbuf);
+
+static void wb_finalize(value vwb)
+{
+  wb_wrap *wbw = wb_wrap_val(vwb);
+  tcxstrdel(wbw->xstr);
+  free(wbw);
+}
+
+static void wb_add(value vwb, int op, const void *kbuf, int ksiz, const void *vbuf, int vsiz)
+{
+  wb_wrap *wbw = wb_wrap_val(vwb);
+  wb_head head;
+  head.op = op;
+  head.ksiz = ksiz;
+  head.vsiz = vsiz;
+  tcxstrcat(wbw->xstr, &head, sizeof(head));
+  tcxstrcat(wbw->xstr, kbuf, ksiz);
+  tcxstrcat(wbw->xstr, vbuf, vsiz);
+  wbw->num++;
+}
+
+static bool wb_apply(wb_wrap *wbw, wb_apply_fn apply, void *db)
+{
+  const char *rp = TCXSTRPTR(wbw->xstr);
+  const char *ep = rp + TCXSTRSIZE(wbw->xstr);
+  wb_head head;
+  while (rp < ep) {
+    memcpy(&head, rp, sizeof(head));
+    rp += sizeof(head);
+    if (!apply(db, &head, rp, rp + head.ksiz)) return false;
+    rp += head.ksiz + head.vsiz;
+  }
+  return true;
+}
+
+CAMLprim
+value otoky_wb_new(value unit)
+{
+  wb_wrap *wbw;
+  value vwb = caml_alloc_final(2, wb_finalize, 1, 100);
+  wbw = caml_stat_alloc(sizeof(wb_wrap));
+  wbw->xstr = tcxstrnew();
+  wbw->num = 0;
+  wb_wrap_val(vwb) = wbw;
+  return vwb;
+}
+
+CAMLprim
+value otoky_wb_clear(value vwb)
+{
+  wb_wrap *wbw = wb_wrap_val(vwb);
+  tcxstrclear(wbw->xstr);
+  wbw->num = 0;
+  return Val_unit;
+}
+
+CAMLprim
+value otoky_wb_num(value vwb)
+{
+  return Val_int(wb_wrap_val(vwb)->num);
+}
+
+CAMLprim
+value otoky_wb_out(value vwb, value vkey, value vlen)
+{
+  wb_add(vwb, Wbout, String_val(vkey), Int_val(vlen), NULL, 0);
+  return Val_unit;
+}
+
+CAMLprim
+value otoky_wb_out_id(value vwb, value vid)
+{
+  int64 id = Int64_val(vid);
+  wb_add(vwb, Wbout | WBID, &id, sizeof(id), NULL, 0);
+  return Val_unit;
+}
+
+CAMLprim
+value otoky_wb_put(value vwb, value vkey, value vkeylen, value vval, value vvallen)
+{
+  wb_add(vwb, Wbput, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  return Val_unit;
+}
+
+CAMLprim
+value otoky_wb_put_id(value vwb, value vid, value vval, value vlen)
+{
+  int64 id = Int64_val(vid);
+  wb_add(vwb, Wbput | WBID, &id, sizeof(id), String_val(vval), Int_val(vlen));
+  return Val_unit;
+}
+
+CAMLprim
+value otoky_wb_putcat(value vwb, value vkey, value vkeylen, value vval, value vvallen)
+{
+  wb_add(vwb, Wbputcat, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  return Val_unit;
+}
+
+CAMLprim
+value otoky_wb_putcat_id(value vwb, value vid, value vval, value vlen)
+{
+  int64 id = Int64_val(vid);
+  wb_add(vwb, Wbputcat | WBID, &id, sizeof(id), String_val(vval), Int_val(vlen));
+  return Val_unit;
+}
+
+CAMLprim
+value otoky_wb_putkeep(value vwb, value vkey, value vkeylen, value vval, value vvallen)
+{
+  wb_add(vwb, Wbputkeep, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  return Val_unit;
+}
+
+CAMLprim
+value otoky_wb_putkeep_id(value vwb, value vid, value vval, value vlen)
+{
+  int64 id = Int64_val(vid);
+  wb_add(vwb, Wbputkeep | WBID, &id, sizeof(id), String_val(vval), Int_val(vlen));
+  return Val_unit;
+}
+
+
+
 typedef struct adb_wrap {
   TCADB *adb;
 } adb_wrap;
@@ -201,9 +445,13 @@ value otoky_adb_adddouble(value vadb, value vkey, value vlen, value vnum)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   double num;
+  double inc = Double_val(vnum);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tcadbadddouble(adbw->adb, String_val(vkey), Int_val(vlen), Double_val(vnum));
+  num = tcadbadddouble(adbw->adb, keybuf.ptr, Int_val(vlen), inc);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (isnan(num)) adb_error(adbw, "adddouble");
   return caml_copy_double (num);
 }
@@ -213,9 +461,12 @@ value otoky_adb_addint(value vadb, value vkey, value vlen, value vnum)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   int num;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tcadbaddint(adbw->adb, String_val(vkey), Int_val(vlen), Int_val(vnum));
+  num = tcadbaddint(adbw->adb, keybuf.ptr, Int_val(vlen), Int_val(vnum));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (num == INT_MIN) adb_error(adbw, "addint");
   return Val_int (num);
 }
@@ -237,21 +488,44 @@ value otoky_adb_copy(value vadb, value vpath)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   bool r;
+  scratch pathbuf;
+  scratch_copy_string(&pathbuf, vpath);
   caml_enter_blocking_section();
-  r = tcadbcopy(adbw->adb, String_val(vpath));
+  r = tcadbcopy(adbw->adb, pathbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&pathbuf);
   if (!r) adb_error(adbw, "copy");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_adb_find(value vadb, value vkey, value vlen)
+{
+  adb_wrap *adbw = adb_wrap_val(vadb);
+  void *val;
+  int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
+  caml_enter_blocking_section();
+  val = tcadbget(adbw->adb, keybuf.ptr, Int_val(vlen), &len);
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!val) return Val_int(0);
+  return make_cstr_option(val, len);
+}
+
 CAMLprim
 TCLIST *otoky_adb_fwmkeys(value vadb, value vmax, value vprefix, value vlen)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   TCLIST *tclist;
+  int max = int_option(vmax);
+  scratch prefixbuf;
+  scratch_copy(&prefixbuf, vprefix, Int_val(vlen));
   caml_enter_blocking_section();
-  tclist = tcadbfwmkeys(adbw->adb, String_val(vprefix), Int_val(vlen), int_option(vmax));
+  tclist = tcadbfwmkeys(adbw->adb, prefixbuf.ptr, Int_val(vlen), max);
   caml_leave_blocking_section();
+  scratch_free(&prefixbuf);
   if (!tclist) adb_error(adbw, "fwmkeys");
   return tclist;
 }
@@ -262,9 +536,12 @@ value otoky_adb_get(value vadb, value vkey, value vlen)
   adb_wrap *adbw = adb_wrap_val(vadb);
   void *val;
   int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  val = tcadbget(adbw->adb, String_val(vkey), Int_val(vlen), &len);
+  val = tcadbget(adbw->adb, keybuf.ptr, Int_val(vlen), &len);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!val) adb_error(adbw, "get");
   return make_cstr(val, len);
 }
@@ -299,9 +576,12 @@ TCLIST *otoky_adb_misc(value vadb, value vname, TCLIST *args)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   TCLIST *r;
+  scratch namebuf;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tcadbmisc(adbw->adb, String_val(vname), args);
+  r = tcadbmisc(adbw->adb, namebuf.ptr, args);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) adb_error(adbw, "misc");
   return r;
 }
@@ -311,9 +591,12 @@ value otoky_adb_open(value vadb, value vname)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   bool r;
+  scratch namebuf;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tcadbopen(adbw->adb, String_val(vname));
+  r = tcadbopen(adbw->adb, namebuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) adb_error(adbw, "open");
   return Val_unit;
 }
@@ -323,9 +606,12 @@ value otoky_adb_optimize(value vadb, value vparams, value vunit)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   bool r;
+  scratch paramsbuf;
+  scratch_copy_string_option(&paramsbuf, vparams);
   caml_enter_blocking_section();
-  r = tcadboptimize(adbw->adb, string_option(vparams));
+  r = tcadboptimize(adbw->adb, paramsbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&paramsbuf);
   if (!r) adb_error(adbw, "optimize");
   return Val_unit;
 }
@@ -335,9 +621,12 @@ value otoky_adb_out(value vadb, value vkey, value vlen)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcadbout(adbw->adb, String_val(vkey), Int_val(vlen));
+  r = tcadbout(adbw->adb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) adb_error(adbw, "out");
   return Val_unit;
 }
@@ -359,9 +648,14 @@ value otoky_adb_put(value vadb, value vkey, value vkeylen, value vval, value vva
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcadbput(adbw->adb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcadbput(adbw->adb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) adb_error(adbw, "put");
   return Val_unit;
 }
@@ -371,9 +665,14 @@ value otoky_adb_putcat(value vadb, value vkey, value vkeylen, value vval, value
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcadbputcat(adbw->adb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcadbputcat(adbw->adb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) adb_error(adbw, "putcat");
   return Val_unit;
 }
@@ -383,9 +682,14 @@ value otoky_adb_putkeep(value vadb, value vkey, value vkeylen, value vval, value
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcadbputkeep(adbw->adb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcadbputkeep(adbw->adb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) adb_error(adbw, "putkeep");
   return Val_unit;
 }
@@ -479,9 +783,12 @@ value otoky_adb_vsiz(value vadb, value vkey, value vkeylen)
 {
   adb_wrap *adbw = adb_wrap_val(vadb);
   int r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
   caml_enter_blocking_section();
-  r = tcadbvsiz(adbw->adb, String_val(vkey), Int_val(vkeylen));
+  r = tcadbvsiz(adbw->adb, keybuf.ptr, Int_val(vkeylen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (r == -1) adb_error(adbw, "vsiz");
   return Val_int(r);
 }
@@ -491,7 +798,10 @@ value otoky_adb_vsiz(value vadb, value vkey, value vkeylen)
 typedef struct bdb_wrap {
   TCBDB *bdb;
   int ref_count;
+  TCCMP cmp;
   value cmpfunc;
+  int *fields;
+  int nfields;
 } bdb_wrap;
 
 #define bdb_wrap_val(v) (*((bdb_wrap **)(Data_custom_val(v))))
@@ -502,6 +812,11 @@ static void bdb_clear_cmpfunc(bdb_wrap *bdbw)
     caml_remove_global_root(&bdbw->cmpfunc);
     bdbw->cmpfunc = Val_unit;
   }
+  if (bdbw->fields) {
+    caml_stat_free(bdbw->fields);
+    bdbw->fields = NULL;
+    bdbw->nfields = 0;
+  }
 }
 
 static void bdb_set_cmpfunc(bdb_wrap *bdbw, value vcmpfunc)
@@ -511,6 +826,18 @@ static void bdb_set_cmpfunc(bdb_wrap *bdbw, value vcmpfunc)
   caml_register_global_root(&bdbw->cmpfunc);
 }
 
+static void bdb_set_fields(bdb_wrap *bdbw, value vfields)
+{
+  value v;
+  int i, n = 0;
+  bdb_clear_cmpfunc(bdbw);
+  for (v = vfields; v != Val_int(0); v = Field(v, 1)) n++;
+  bdbw->fields = caml_stat_alloc((n + 1) * sizeof(int));
+  bdbw->nfields = n;
+  for (i = 0, v = vfields; i < n; i++, v = Field(v, 1))
+    bdbw->fields[i] = Int_val(Field(v, 0));
+}
+
 static void bdb_decr_ref_count(bdb_wrap *bdbw)
 {
   if (--bdbw->ref_count == 0) {
@@ -544,7 +871,10 @@ value otoky_bdb_new(value unit)
   bdbw = caml_stat_alloc(sizeof(bdb_wrap));
   bdbw->bdb = bdb;
   bdbw->ref_count = 1;
+  bdbw->cmp = tccmplexical;
   bdbw->cmpfunc = Val_unit;
+  bdbw->fields = NULL;
+  bdbw->nfields = 0;
   bdb_wrap_val(vbdb) = bdbw;
   return vbdb;
 }
@@ -554,9 +884,13 @@ value otoky_bdb_adddouble(value vbdb, value vkey, value vlen, value vnum)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   double num;
+  double inc = Double_val(vnum);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tcbdbadddouble(bdbw->bdb, String_val(vkey), Int_val(vlen), Double_val(vnum));
+  num = tcbdbadddouble(bdbw->bdb, keybuf.ptr, Int_val(vlen), inc);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (isnan(num)) bdb_error(bdbw, "adddouble");
   return caml_copy_double(num);
 }
@@ -566,13 +900,59 @@ value otoky_bdb_addint(value vbdb, value vkey, value vlen, value vnum)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   int num;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tcbdbaddint(bdbw->bdb, String_val(vkey), Int_val(vlen), Int_val(vnum));
+  num = tcbdbaddint(bdbw->bdb, keybuf.ptr, Int_val(vlen), Int_val(vnum));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (num == INT_MIN) bdb_error(bdbw, "addint");
   return Val_int (num);
 }
 
+static bool bdb_apply_rec(void *db, const wb_head *head, const char *kbuf, const char *vbuf)
+{
+  TCBDB *bdb = db;
+  switch (head->op) {
+  case Wbput:
+    return tcbdbput(bdb, kbuf, head->ksiz, vbuf, head->vsiz);
+  case Wbputkeep:
+    /* an existing record isn't a reason to abort the batch */
+    return tcbdbputkeep(bdb, kbuf, head->ksiz, vbuf, head->vsiz) || tcbdbecode(bdb) == TCEKEEP;
+  case Wbputcat:
+    return tcbdbputcat(bdb, kbuf, head->ksiz, vbuf, head->vsiz);
+  case Wbout:
+    return tcbdbout(bdb, kbuf, head->ksiz) || tcbdbecode(bdb) == TCENOREC;
+  default:
+    tcbdbsetecode(bdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    return false;
+  }
+}
+
+CAMLprim
+value otoky_bdb_apply(value vbdb, value vwb)
+{
+  CAMLparam1(vwb);
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  wb_wrap *wbw = wb_wrap_val(vwb);
+  int ecode = TCESUCCESS;
+  bool r;
+  caml_enter_blocking_section();
+  r = tcbdbtranbegin(bdbw->bdb);
+  if (!r)
+    ecode = tcbdbecode(bdbw->bdb);
+  else if (!wb_apply(wbw, bdb_apply_rec, bdbw->bdb)) {
+    ecode = tcbdbecode(bdbw->bdb);
+    (void)tcbdbtranabort(bdbw->bdb);
+    r = false;
+  }
+  else if (!(r = tcbdbtrancommit(bdbw->bdb)))
+    ecode = tcbdbecode(bdbw->bdb);
+  caml_leave_blocking_section();
+  if (!r) raise_error_exn(ecode, "apply");
+  CAMLreturn(Val_unit);
+}
+
 CAMLprim
 value otoky_bdb_close(value vbdb)
 {
@@ -591,13 +971,35 @@ value otoky_bdb_copy(value vbdb, value vpath)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  scratch pathbuf;
+  scratch_copy_string(&pathbuf, vpath);
   caml_enter_blocking_section();
-  r = tcbdbcopy(bdbw->bdb, String_val(vpath));
+  r = tcbdbcopy(bdbw->bdb, pathbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&pathbuf);
   if (!r) bdb_error(bdbw, "copy");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdb_find(value vbdb, value vkey, value vlen)
+{
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  void *val;
+  int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
+  caml_enter_blocking_section();
+  val = tcbdbget(bdbw->bdb, keybuf.ptr, Int_val(vlen), &len);
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!val) {
+    if (tcbdbecode(bdbw->bdb) == TCENOREC) return Val_int(0);
+    bdb_error(bdbw, "find");
+  }
+  return make_cstr_option(val, len);
+}
+
 CAMLprim
 value otoky_bdb_fsiz(value vbdb)
 {
@@ -615,9 +1017,13 @@ TCLIST *otoky_bdb_fwmkeys(value vbdb, value vmax, value vprefix, value vlen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   TCLIST *tclist;
+  int max = int_option(vmax);
+  scratch prefixbuf;
+  scratch_copy(&prefixbuf, vprefix, Int_val(vlen));
   caml_enter_blocking_section();
-  tclist = tcbdbfwmkeys(bdbw->bdb, String_val(vprefix), Int_val(vlen), int_option(vmax));
+  tclist = tcbdbfwmkeys(bdbw->bdb, prefixbuf.ptr, Int_val(vlen), max);
   caml_leave_blocking_section();
+  scratch_free(&prefixbuf);
   if (!tclist) bdb_error(bdbw, "fwmkeys");
   return tclist;
 }
@@ -628,33 +1034,80 @@ value otoky_bdb_get(value vbdb, value vkey, value vlen)
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   void *val;
   int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  val = tcbdbget(bdbw->bdb, String_val(vkey), Int_val(vlen), &len);
+  val = tcbdbget(bdbw->bdb, keybuf.ptr, Int_val(vlen), &len);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!val) bdb_error(bdbw, "get");
   return make_cstr(val, len);
 }
 
+CAMLprim
+value otoky_bdb_get_into(value vbdb, value vkey, value vlen, value vbuf)
+{
+  CAMLparam1(vbuf);
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  char *buf = Caml_ba_data_val(vbuf);
+  intnat dim = Caml_ba_array_val(vbuf)->dim[0];
+  int max = (dim > INT_MAX) ? INT_MAX : (int)dim;
+  void *val;
+  int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
+  caml_enter_blocking_section();
+  /* tcbdbget3 points into the leaf page, which another thread may change, so copy under the lock */
+  val = tcbdbget(bdbw->bdb, keybuf.ptr, Int_val(vlen), &len);
+  if (val) {
+    memcpy(buf, val, (len < max) ? len : max);
+    tcfree(val);
+  }
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!val) bdb_error(bdbw, "get_into");
+  CAMLreturn(Val_int(len));
+}
+
 CAMLprim
 TCLIST *otoky_bdb_getlist(value vbdb, value vkey, value vlen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   TCLIST *tclist;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  tclist = tcbdbget4(bdbw->bdb, String_val(vkey), Int_val(vlen));
+  tclist = tcbdbget4(bdbw->bdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!tclist) bdb_error(bdbw, "getlist");
   return tclist;
 }
 
+CAMLprim
+value otoky_bdb_opaque(value vbdb)
+{
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  value vopaque;
+  char *opaque = tcbdbopaque(bdbw->bdb);
+  if (!opaque) bdb_error(bdbw, "opaque");
+  vopaque = caml_alloc_string(BDB_OPAQUE_SIZ);
+  memcpy(String_val(vopaque), opaque, BDB_OPAQUE_SIZ);
+  return vopaque;
+}
+
 CAMLprim
 value otoky_bdb_open(value vbdb, value vmode, value vname)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  int mode = omode_int_of_list(vmode);
+  scratch namebuf;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tcbdbopen(bdbw->bdb, String_val(vname), omode_int_of_list(vmode));
+  r = tcbdbopen(bdbw->bdb, namebuf.ptr, mode);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) bdb_error(bdbw, "open");
   return Val_unit;
 }
@@ -664,10 +1117,14 @@ value otoky_bdb_optimize(value vbdb, value vlmemb, value vnmemb, value vbnum, va
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  int32 lmemb = int32_option(vlmemb);
+  int32 nmemb = int32_option(vnmemb);
+  int64 bnum = int64_option(vbnum);
+  int apow = int_option(vapow);
+  int fpow = int_option(vfpow);
+  int opts = opt_int_of_list(vopts);
   caml_enter_blocking_section();
-  r = tcbdboptimize(bdbw->bdb,
-                    int32_option(vlmemb), int32_option(vnmemb), int64_option(vbnum),
-                    int_option(vapow), int_option(vfpow), opt_int_of_list(vopts));
+  r = tcbdboptimize(bdbw->bdb, lmemb, nmemb, bnum, apow, fpow, opts);
   caml_leave_blocking_section();
   if (!r) bdb_error(bdbw, "optimize");
   return Val_unit;
@@ -684,9 +1141,12 @@ value otoky_bdb_out(value vbdb, value vkey, value vlen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcbdbout(bdbw->bdb, String_val(vkey), Int_val(vlen));
+  r = tcbdbout(bdbw->bdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) bdb_error(bdbw, "out");
   return Val_unit;
 }
@@ -696,9 +1156,12 @@ value otoky_bdb_outlist(value vbdb, value vkey, value vlen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcbdbout3(bdbw->bdb, String_val(vkey), Int_val(vlen));
+  r = tcbdbout3(bdbw->bdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) bdb_error(bdbw, "outlist");
   return Val_unit;
 }
@@ -720,57 +1183,172 @@ value otoky_bdb_put(value vbdb, value vkey, value vkeylen, value vval, value vva
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcbdbput(bdbw->bdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcbdbput(bdbw->bdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) bdb_error(bdbw, "put");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdb_put_ba(value vbdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tcbdbput(bdbw->bdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) bdb_error(bdbw, "put_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_bdb_put_ba_bc(value *argv, int argn)
+{
+  return otoky_bdb_put_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_bdb_putcat(value vbdb, value vkey, value vkeylen, value vval, value vvallen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcbdbputcat(bdbw->bdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcbdbputcat(bdbw->bdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) bdb_error(bdbw, "putcat");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdb_putcat_ba(value vbdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tcbdbputcat(bdbw->bdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) bdb_error(bdbw, "putcat_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_bdb_putcat_ba_bc(value *argv, int argn)
+{
+  return otoky_bdb_putcat_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_bdb_putdup(value vbdb, value vkey, value vkeylen, value vval, value vvallen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcbdbputdup(bdbw->bdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcbdbputdup(bdbw->bdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) bdb_error(bdbw, "putdup");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdb_putdup_ba(value vbdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tcbdbputdup(bdbw->bdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) bdb_error(bdbw, "putdup_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_bdb_putdup_ba_bc(value *argv, int argn)
+{
+  return otoky_bdb_putdup_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_bdb_putkeep(value vbdb, value vkey, value vkeylen, value vval, value vvallen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcbdbputkeep(bdbw->bdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcbdbputkeep(bdbw->bdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) bdb_error(bdbw, "putkeep");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdb_putkeep_ba(value vbdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tcbdbputkeep(bdbw->bdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) bdb_error(bdbw, "putkeep_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_bdb_putkeep_ba_bc(value *argv, int argn)
+{
+  return otoky_bdb_putkeep_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_bdb_putlist(value vbdb, value vkey, value vlen, TCLIST *tclist)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcbdbputdup3(bdbw->bdb, String_val(vkey), Int_val(vlen), tclist);
+  r = tcbdbputdup3(bdbw->bdb, keybuf.ptr, Int_val(vlen), tclist);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) bdb_error(bdbw, "putlist");
   return Val_unit;
 }
@@ -780,12 +1358,19 @@ TCLIST *otoky_bdb_range(value vbdb, value vbkey, value vblen, value vbinc, value
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   TCLIST *tclist;
+  bool binc = bool_option(vbinc);
+  bool einc = bool_option(veinc);
+  int max = int_option(vmax);
+  scratch bkeybuf, ekeybuf;
+  scratch_copy_option(&bkeybuf, vbkey, Int_val(vblen));
+  scratch_copy_option(&ekeybuf, vekey, Int_val(velen));
   caml_enter_blocking_section();
   tclist = tcbdbrange(bdbw->bdb,
-                      string_option(vbkey), Int_val(vblen), bool_option(vbinc),
-                      string_option(vekey), Int_val(velen), bool_option(veinc),
-                      int_option(vmax));
+                      bkeybuf.ptr, Int_val(vblen), binc,
+                      ekeybuf.ptr, Int_val(velen), einc, max);
   caml_leave_blocking_section();
+  scratch_free(&bkeybuf);
+  scratch_free(&ekeybuf);
   if (!tclist) bdb_error(bdbw, "range");
   return tclist;
 }
@@ -796,6 +1381,72 @@ TCLIST *otoky_bdb_range_bc(value *argv, int argn)
   return otoky_bdb_range(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8]);
 }
 
+/* node IDs start here, lower IDs are leaves (BDBNODEIDBASE in tcbdb.c) */
+#define BDB_NODEIDBASE ((1LL << 48) + 1)
+
+/*
+  pushes the index keys of node id onto keys, in order, including
+  those of its child nodes down to depth more levels. nodes are read
+  as last written to the file, so a stale or missing node only gives
+  fewer keys; any key is still a valid range boundary.
+*/
+static void bdb_node_keys(TCBDB *bdb, uint64 id, int depth, TCLIST *keys)
+{
+  char hbuf[(sizeof(uint64) + 1) * 2];
+  char *rbuf;
+  const char *rp;
+  int hsiz, rsiz, step, ksiz;
+  uint64 heir, pid;
+  if (id < BDB_NODEIDBASE) return;
+  hsiz = sprintf(hbuf, "#%llx", (unsigned long long)(id - BDB_NODEIDBASE));
+  rbuf = tchdbget(bdb->hdb, hbuf, hsiz, &rsiz);
+  if (!rbuf) return;
+  rp = rbuf;
+  TCREADVNUMBUF64(rp, heir, step);
+  rp += step;
+  rsiz -= step;
+  if (depth > 0) bdb_node_keys(bdb, heir, depth - 1, keys);
+  while (rsiz >= 2) {
+    TCREADVNUMBUF64(rp, pid, step);
+    rp += step;
+    rsiz -= step;
+    TCREADVNUMBUF(rp, ksiz, step);
+    rp += step;
+    rsiz -= step;
+    if (ksiz < 0 || rsiz < ksiz) break;
+    tclistpush(keys, rp, ksiz);
+    rp += ksiz;
+    rsiz -= ksiz;
+    if (depth > 0) bdb_node_keys(bdb, pid, depth - 1, keys);
+  }
+  tcfree(rbuf);
+}
+
+/*
+  ascending keys from the top of the tree, which split it into
+  subtrees of about equal size: the root's index keys, or if it has
+  fewer than num, the keys of the level below it as well. reads at
+  most the root and its children, never a leaf.
+*/
+CAMLprim
+TCLIST *otoky_bdb_separators(value vbdb, value vnum)
+{
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  TCBDB *bdb = bdbw->bdb;
+  int num = Int_val(vnum);
+  TCLIST *keys = tclistnew();
+  caml_enter_blocking_section();
+  if (bdb->mmtx) pthread_rwlock_wrlock((pthread_rwlock_t *)bdb->mmtx);
+  bdb_node_keys(bdb, bdb->root, 0, keys);
+  if (tclistnum(keys) < num) {
+    tclistclear(keys);
+    bdb_node_keys(bdb, bdb->root, 1, keys);
+  }
+  if (bdb->mmtx) pthread_rwlock_unlock((pthread_rwlock_t *)bdb->mmtx);
+  caml_leave_blocking_section();
+  return keys;
+}
+
 CAMLprim
 value otoky_bdb_rnum(value vbdb)
 {
@@ -813,15 +1464,18 @@ value otoky_bdb_setcache(value vbdb, value vlcnum, value vncnum, value vunit)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  int32 lcnum = int32_option(vlcnum);
+  int32 ncnum = int32_option(vncnum);
   caml_enter_blocking_section();
-  r = tcbdbsetcache(bdbw->bdb, int32_option(vlcnum), int32_option(vncnum));
+  r = tcbdbsetcache(bdbw->bdb, lcnum, ncnum);
   caml_leave_blocking_section();
   if (!r) bdb_error(bdbw, "setcache");
   return Val_unit;
 }
 
 enum cmpfunc { Cmp_lexical, Cmp_decimal, Cmp_int32, Cmp_int64 };
-enum cmpfunc_block { Cmp_custom, Cmp_custom_cstr };
+enum cmpfunc_block { Cmp_custom, Cmp_custom_cstr, Cmp_fields };
+enum cmpfield { Cf_int32, Cf_int64, Cf_string };
 
 static int cmp_custom(const char *aptr, int asiz, const char *bptr, int bsiz, bdb_wrap *bdbw) {
   value a, b, vr;
@@ -856,6 +1510,86 @@ static int cmp_custom_cstr(const char *aptr, int asiz, const char *bptr, int bsi
   return r;
 }
 
+/*
+  Cmp_fields keys are a sequence of big-endian two's complement ints
+  and strings with a 4-byte big-endian length prefix, compared field
+  by field without calling back into OCaml. Keys that don't match the
+  fields (e.g. the Otoky type_desc hash key) sort first.
+*/
+
+static uint64 read_be(const unsigned char *p, int n)
+{
+  uint64 r = 0;
+  while (n--) r = (r << 8) | *p++;
+  return r;
+}
+
+static int fields_valid(bdb_wrap *bdbw, const unsigned char *p, int siz)
+{
+  int i, pos = 0;
+  uint64 len;
+  for (i = 0; i < bdbw->nfields; i++) {
+    switch (bdbw->fields[i]) {
+    case Cf_int32: pos += 4; break;
+    case Cf_int64: pos += 8; break;
+    case Cf_string:
+      if (pos + 4 > siz) return 0;
+      len = read_be(p + pos, 4);
+      pos += 4;
+      if (len > siz - pos) return 0;
+      pos += len;
+      break;
+    }
+    if (pos > siz) return 0;
+  }
+  return pos == siz;
+}
+
+static int cmp_fields(const char *aptr, int asiz, const char *bptr, int bsiz, bdb_wrap *bdbw) {
+  const unsigned char *a = (const unsigned char *)aptr;
+  const unsigned char *b = (const unsigned char *)bptr;
+  int avalid = fields_valid(bdbw, a, asiz);
+  int bvalid = fields_valid(bdbw, b, bsiz);
+  int i, r;
+  int64 x, y;
+  int alen, blen;
+
+  if (!avalid || !bvalid) {
+    if (avalid) return 1;
+    if (bvalid) return -1;
+    return tccmplexical(aptr, asiz, bptr, bsiz, NULL);
+  }
+
+  for (i = 0; i < bdbw->nfields; i++) {
+    switch (bdbw->fields[i]) {
+    case Cf_int32:
+      x = (int32)read_be(a, 4);
+      y = (int32)read_be(b, 4);
+      if (x != y) return (x < y) ? -1 : 1;
+      a += 4; b += 4;
+      break;
+
+    case Cf_int64:
+      x = (int64)read_be(a, 8);
+      y = (int64)read_be(b, 8);
+      if (x != y) return (x < y) ? -1 : 1;
+      a += 8; b += 8;
+      break;
+
+    case Cf_string:
+      alen = read_be(a, 4);
+      blen = read_be(b, 4);
+      a += 4; b += 4;
+      r = memcmp(a, b, (alen < blen) ? alen : blen);
+      if (r != 0) return (r < 0) ? -1 : 1;
+      if (alen != blen) return (alen < blen) ? -1 : 1;
+      a += alen; b += blen;
+      break;
+    }
+  }
+  return 0;
+}
+
 CAMLprim
 value otoky_bdb_setcmpfunc(value vbdb, value vcmpfunc)
 {
@@ -874,16 +1608,26 @@ value otoky_bdb_setcmpfunc(value vbdb, value vcmpfunc)
   }
   else {
     switch (Tag_val(vcmpfunc)) {
-    case Cmp_custom:      cmp = (TCCMP)cmp_custom;      break;
-    case Cmp_custom_cstr: cmp = (TCCMP)cmp_custom_cstr; break;
+    case Cmp_custom:
+      cmp = (TCCMP)cmp_custom;
+      bdb_set_cmpfunc(bdbw, Field(vcmpfunc, 0));
+      break;
+    case Cmp_custom_cstr:
+      cmp = (TCCMP)cmp_custom_cstr;
+      bdb_set_cmpfunc(bdbw, Field(vcmpfunc, 0));
+      break;
+    case Cmp_fields:
+      cmp = (TCCMP)cmp_fields;
+      bdb_set_fields(bdbw, Field(vcmpfunc, 0));
+      break;
     }
-    bdb_set_cmpfunc(bdbw, Field(vcmpfunc, 0));
   }
 
   caml_enter_blocking_section();
   r = tcbdbsetcmpfunc(bdbw->bdb, cmp, (void *)bdbw);
   caml_leave_blocking_section();
   if (!r) bdb_error(bdbw, "setcmpfunc");
+  bdbw->cmp = cmp;
   return Val_unit;
 }
 
@@ -892,20 +1636,37 @@ value otoky_bdb_setdfunit(value vbdb, value vdfunit)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  int32 dfunit = Int32_val(vdfunit);
   caml_enter_blocking_section();
-  r = tcbdbsetdfunit(bdbw->bdb, Int32_val(vdfunit));
+  r = tcbdbsetdfunit(bdbw->bdb, dfunit);
   caml_leave_blocking_section();
   if (!r) bdb_error(bdbw, "setdfunit");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdb_setopaque(value vbdb, value voff, value vstr)
+{
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  char *opaque = tcbdbopaque(bdbw->bdb);
+  if (!opaque) bdb_error(bdbw, "setopaque");
+  /* a reader's header isn't written back */
+  if (!bdbw->bdb->wmode) {
+    tcbdbsetecode(bdbw->bdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    bdb_error(bdbw, "setopaque");
+  }
+  memcpy(opaque + Int_val(voff), String_val(vstr), caml_string_length(vstr));
+  return Val_unit;
+}
+
 CAMLprim
 value otoky_bdb_setxmsiz(value vbdb, value vxmsiz)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  int64 xmsiz = Int64_val(vxmsiz);
   caml_enter_blocking_section();
-  r = tcbdbsetxmsiz(bdbw->bdb, Int64_val(vxmsiz));
+  r = tcbdbsetxmsiz(bdbw->bdb, xmsiz);
   caml_leave_blocking_section();
   if (!r) bdb_error(bdbw, "setxmsiz");
   return Val_unit;
@@ -964,10 +1725,14 @@ value otoky_bdb_tune(value vbdb, value vlmemb, value vnmemb, value vbnum, value
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   bool r;
+  int32 lmemb = int32_option(vlmemb);
+  int32 nmemb = int32_option(vnmemb);
+  int64 bnum = int64_option(vbnum);
+  int apow = int_option(vapow);
+  int fpow = int_option(vfpow);
+  int opts = opt_int_of_list(vopts);
   caml_enter_blocking_section();
-  r = tcbdbtune(bdbw->bdb,
-                int32_option(vlmemb), int32_option(vnmemb), int64_option(vbnum),
-                int_option(vapow), int_option(vfpow), opt_int_of_list(vopts));
+  r = tcbdbtune(bdbw->bdb, lmemb, nmemb, bnum, apow, fpow, opts);
   caml_leave_blocking_section();
   if (!r) bdb_error(bdbw, "tune");
   return Val_unit;
@@ -996,9 +1761,12 @@ value otoky_bdb_vnum(value vbdb, value vkey, value vlen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   int r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcbdbvnum(bdbw->bdb, String_val(vkey), Int_val(vlen));
+  r = tcbdbvnum(bdbw->bdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (r == -1) bdb_error(bdbw, "vnum");
   return Val_int(r);
 }
@@ -1008,9 +1776,12 @@ value otoky_bdb_vsiz(value vbdb, value vkey, value vlen)
 {
   bdb_wrap *bdbw = bdb_wrap_val(vbdb);
   int r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcbdbvsiz(bdbw->bdb, String_val(vkey), Int_val(vlen));
+  r = tcbdbvsiz(bdbw->bdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (r == -1) bdb_error(bdbw, "vsiz");
   return Val_int(r);
 }
@@ -1038,22 +1809,123 @@ static void bdbcur_error(bdbcur_wrap *bdbcurw, const char *fn_name)
   bdb_error(bdbcurw->bdbw, fn_name);
 }
 
-CAMLprim
-value otoky_bdbcur_new(value vbdb)
-{
-  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
-  value vbdbcur;
-  bdbcur_wrap *bdbcurw;
-  vbdbcur = caml_alloc_final(2, bdbcur_finalize, 1, 100);
-  bdbcurw = caml_stat_alloc(sizeof(bdbcur_wrap));
-  bdbcurw->bdbcur = tcbdbcurnew(bdbw->bdb);
-  bdbcurw->bdbw = bdbw;
-  bdbw->ref_count++;
-  bdbcur_wrap_val(vbdbcur) = bdbcurw;
-  return vbdbcur;
+typedef bool (*bdbcur_step)(BDBCUR *);
+
+/*
+  Read up to num records from the cursor, stepping forward (or back)
+  and stopping past ekey, and leave the cursor on the first record
+  not read. In keys mode duplicates of a key are read once; in pairs
+  mode bufs holds keys and values alternately. Returns the number of
+  records read, or -1 on error.
+*/
+static int bdbcur_range_read(bdbcur_wrap *bdbcurw, const void *ekey, int elen, bool einc,
+                             int num, bool pairs, bdbcur_step step, void **bufs, int *sizs)
+{
+  bdb_wrap *bdbw = bdbcurw->bdbw;
+  BDBCUR *bdbcur = bdbcurw->bdbcur;
+  void *kbuf, *vbuf;
+  int ksiz, vsiz, c, n = 0, i = 0;
+
+  kbuf = tcbdbcurkey(bdbcur, &ksiz);
+  while (kbuf) {
+    if (n == num) break;
+    if (ekey) {
+      c = bdbw->cmp(kbuf, ksiz, ekey, elen, bdbw);
+      if (c > 0 || (c == 0 && !einc)) break;
+    }
+    if (pairs && !(vbuf = tcbdbcurval(bdbcur, &vsiz))) {
+      tcfree(kbuf);
+      kbuf = NULL;
+      break;
+    }
+    bufs[i] = kbuf;
+    sizs[i++] = ksiz;
+    n++;
+    if (pairs) {
+      bufs[i] = vbuf;
+      sizs[i++] = vsiz;
+      kbuf = step(bdbcur) ? tcbdbcurkey(bdbcur, &ksiz) : NULL;
+    }
+    else {
+      /* duplicates have byte-identical keys */
+      for (;;) {
+        kbuf = step(bdbcur) ? tcbdbcurkey(bdbcur, &ksiz) : NULL;
+        if (!kbuf || ksiz != sizs[i - 1] || memcmp(kbuf, bufs[i - 1], ksiz)) break;
+        tcfree(kbuf);
+      }
+    }
+  }
+
+  if (kbuf)
+    tcfree(kbuf);
+  else if (tcbdbecode(bdbw->bdb) != TCENOREC) {
+    while (i > 0) tcfree(bufs[--i]);
+    return -1;
+  }
+  return n;
 }
 
-CAMLprim
+static value bdbcur_range(value vbdbcur, value vekey, value velen, value veinc, value vnum,
+                          bool pairs, bdbcur_step step, const char *fn_name)
+{
+  CAMLparam0();
+  CAMLlocal2(vrecs, vkey);
+  bdbcur_wrap *bdbcurw = bdbcur_wrap_val(vbdbcur);
+  bool einc = bool_option(veinc);
+  int i, n, num = Int_val(vnum);
+  int width = pairs ? 2 : 1;
+  void **bufs;
+  int *sizs;
+  scratch ekeybuf;
+
+  if (num <= 0) CAMLreturn(Atom(0));
+
+  bufs = tcmalloc(width * num * sizeof(void *));
+  sizs = tcmalloc(width * num * sizeof(int));
+  scratch_copy_option(&ekeybuf, vekey, Int_val(velen));
+  caml_enter_blocking_section();
+  n = bdbcur_range_read(bdbcurw, ekeybuf.ptr, Int_val(velen), einc, num, pairs, step, bufs, sizs);
+  caml_leave_blocking_section();
+  scratch_free(&ekeybuf);
+
+  if (n == -1) {
+    tcfree(bufs);
+    tcfree(sizs);
+    bdbcur_error(bdbcurw, fn_name);
+  }
+
+  if (pairs)
+    vrecs = make_cstr_pairs(n, bufs, sizs);
+  else if (n == 0)
+    vrecs = Atom(0);
+  else {
+    vrecs = caml_alloc(n, 0);
+    for (i = 0; i < n; i++) {
+      vkey = make_cstr(bufs[i], sizs[i]);
+      Store_field(vrecs, i, vkey);
+    }
+  }
+  tcfree(bufs);
+  tcfree(sizs);
+  CAMLreturn(vrecs);
+}
+
+CAMLprim
+value otoky_bdbcur_new(value vbdb)
+{
+  bdb_wrap *bdbw = bdb_wrap_val(vbdb);
+  value vbdbcur;
+  bdbcur_wrap *bdbcurw;
+  vbdbcur = caml_alloc_final(2, bdbcur_finalize, 1, 100);
+  bdbcurw = caml_stat_alloc(sizeof(bdbcur_wrap));
+  bdbcurw->bdbcur = tcbdbcurnew(bdbw->bdb);
+  bdbcurw->bdbw = bdbw;
+  bdbw->ref_count++;
+  bdbcur_wrap_val(vbdbcur) = bdbcurw;
+  return vbdbcur;
+}
+
+CAMLprim
 value otoky_bdbcur_first(value vbdbcur)
 {
   bdbcur_wrap *bdbcurw = bdbcur_wrap_val(vbdbcur);
@@ -1070,9 +1942,12 @@ value otoky_bdbcur_jump(value vbdbcur, value vkey, value vlen)
 {
   bdbcur_wrap *bdbcurw = bdbcur_wrap_val(vbdbcur);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcbdbcurjump(bdbcurw->bdbcur, String_val(vkey), Int_val(vlen));
+  r = tcbdbcurjump(bdbcurw->bdbcur, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) bdbcur_error(bdbcurw, "jump");
   return Val_unit;
 }
@@ -1114,6 +1989,12 @@ value otoky_bdbcur_next(value vbdbcur)
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdbcur_next_n(value vbdbcur, value vnum)
+{
+  return bdbcur_range(vbdbcur, Val_int(0), Val_int(-1), Val_int(0), vnum, true, tcbdbcurnext, "next_n");
+}
+
 CAMLprim
 value otoky_bdbcur_out(value vbdbcur)
 {
@@ -1138,6 +2019,12 @@ value otoky_bdbcur_prev(value vbdbcur)
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdbcur_prev_n(value vbdbcur, value vnum)
+{
+  return bdbcur_range(vbdbcur, Val_int(0), Val_int(-1), Val_int(0), vnum, true, tcbdbcurprev, "prev_n");
+}
+
 enum cpmode {
   Cp_current,
   Cp_before,
@@ -1150,6 +2037,7 @@ value otoky_bdbcur_put(value vbdbcur, value vcpmode, value vval, value vlen)
   bdbcur_wrap *bdbcurw = bdbcur_wrap_val(vbdbcur);
   bool r;
   int cpmode = BDBCPCURRENT;
+  scratch valbuf;
   if (vcpmode != Val_int(0)) {
     switch (Int_val(Field(vcpmode, 0))) {
     case Cp_current: cpmode = BDBCPCURRENT; break;
@@ -1157,13 +2045,70 @@ value otoky_bdbcur_put(value vbdbcur, value vcpmode, value vval, value vlen)
     case Cp_after:   cpmode = BDBCPAFTER;   break;
     }
   }
+  scratch_copy(&valbuf, vval, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcbdbcurput(bdbcurw->bdbcur, String_val(vval), Int_val(vlen), cpmode);
+  r = tcbdbcurput(bdbcurw->bdbcur, valbuf.ptr, Int_val(vlen), cpmode);
   caml_leave_blocking_section ();
+  scratch_free(&valbuf);
   if (!r) bdbcur_error(bdbcurw, "put");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_bdbcur_range(value vbdbcur, value vekey, value velen, value veinc, value vnum)
+{
+  return bdbcur_range(vbdbcur, vekey, velen, veinc, vnum, false, tcbdbcurnext, "range");
+}
+
+CAMLprim
+value otoky_bdbcur_range_pairs(value vbdbcur, value vekey, value velen, value veinc, value vnum)
+{
+  return bdbcur_range(vbdbcur, vekey, velen, veinc, vnum, true, tcbdbcurnext, "range");
+}
+
+CAMLprim
+value otoky_bdbcur_range_start(value vbdbcur, value vbkey, value vblen, value vbinc, value vunit)
+{
+  bdbcur_wrap *bdbcurw = bdbcur_wrap_val(vbdbcur);
+  bdb_wrap *bdbw = bdbcurw->bdbw;
+  bool r, binc = bool_option(vbinc);
+  int blen = Int_val(vblen);
+  void *kbuf;
+  int ksiz;
+  scratch bkeybuf;
+  scratch_copy_option(&bkeybuf, vbkey, blen);
+  caml_enter_blocking_section();
+  if (!bkeybuf.ptr)
+    r = tcbdbcurfirst(bdbcurw->bdbcur);
+  else {
+    r = tcbdbcurjump(bdbcurw->bdbcur, bkeybuf.ptr, blen);
+    while (r && !binc && (kbuf = tcbdbcurkey(bdbcurw->bdbcur, &ksiz))) {
+      bool skip = bdbw->cmp(kbuf, ksiz, bkeybuf.ptr, blen, bdbw) == 0;
+      tcfree(kbuf);
+      if (!skip) break;
+      r = tcbdbcurnext(bdbcurw->bdbcur);
+    }
+  }
+  caml_leave_blocking_section();
+  scratch_free(&bkeybuf);
+  if (!r && tcbdbecode(bdbw->bdb) != TCENOREC) bdbcur_error(bdbcurw, "range");
+  return Val_bool(r);
+}
+
+/* moves forward up to num records without reading them; returns how many it moved */
+CAMLprim
+value otoky_bdbcur_skip(value vbdbcur, value vnum)
+{
+  bdbcur_wrap *bdbcurw = bdbcur_wrap_val(vbdbcur);
+  int n = 0, num = Int_val(vnum);
+  bool r = true;
+  caml_enter_blocking_section();
+  while (n < num && (r = tcbdbcurnext(bdbcurw->bdbcur))) n++;
+  caml_leave_blocking_section();
+  if (!r && tcbdbecode(bdbcurw->bdbw->bdb) != TCENOREC) bdbcur_error(bdbcurw, "skip");
+  return Val_int(n);
+}
+
 CAMLprim
 value otoky_bdbcur_val(value vbdbcur)
 {
@@ -1218,8 +2163,10 @@ value otoky_fdb_adddouble(value vfdb, value vkey, value vnum)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   double num;
+  int64 key = Int64_val(vkey);
+  double inc = Double_val(vnum);
   caml_enter_blocking_section();
-  num = tcfdbadddouble(fdbw->fdb, Int64_val(vkey), Double_val(vnum));
+  num = tcfdbadddouble(fdbw->fdb, key, inc);
   caml_leave_blocking_section();
   if (isnan(num)) fdb_error(fdbw, "adddouble");
   return caml_copy_double(num);
@@ -1230,13 +2177,66 @@ value otoky_fdb_addint(value vfdb, value vkey, value vnum)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   int num;
+  int64 key = Int64_val(vkey);
   caml_enter_blocking_section();
-  num = tcfdbaddint(fdbw->fdb, Int64_val(vkey), Int_val(vnum));
+  num = tcfdbaddint(fdbw->fdb, key, Int_val(vnum));
   caml_leave_blocking_section();
   if (num == INT_MIN) fdb_error(fdbw, "addint");
   return Val_int (num);
 }
 
+static bool fdb_apply_rec(void *db, const wb_head *head, const char *kbuf, const char *vbuf)
+{
+  TCFDB *fdb = db;
+  int64 id;
+  if (head->op & WBID) memcpy(&id, kbuf, sizeof(id));
+  switch (head->op) {
+  case Wbput:
+    return tcfdbput2(fdb, kbuf, head->ksiz, vbuf, head->vsiz);
+  case Wbput | WBID:
+    return tcfdbput(fdb, id, vbuf, head->vsiz);
+  case Wbputkeep:
+    return tcfdbputkeep2(fdb, kbuf, head->ksiz, vbuf, head->vsiz) || tcfdbecode(fdb) == TCEKEEP;
+  case Wbputkeep | WBID:
+    return tcfdbputkeep(fdb, id, vbuf, head->vsiz) || tcfdbecode(fdb) == TCEKEEP;
+  case Wbputcat:
+    return tcfdbputcat2(fdb, kbuf, head->ksiz, vbuf, head->vsiz);
+  case Wbputcat | WBID:
+    return tcfdbputcat(fdb, id, vbuf, head->vsiz);
+  case Wbout:
+    return tcfdbout2(fdb, kbuf, head->ksiz) || tcfdbecode(fdb) == TCENOREC;
+  case Wbout | WBID:
+    return tcfdbout(fdb, id) || tcfdbecode(fdb) == TCENOREC;
+  default:
+    tcfdbsetecode(fdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    return false;
+  }
+}
+
+CAMLprim
+value otoky_fdb_apply(value vfdb, value vwb)
+{
+  CAMLparam1(vwb);
+  fdb_wrap *fdbw = fdb_wrap_val(vfdb);
+  wb_wrap *wbw = wb_wrap_val(vwb);
+  int ecode = TCESUCCESS;
+  bool r;
+  caml_enter_blocking_section();
+  r = tcfdbtranbegin(fdbw->fdb);
+  if (!r)
+    ecode = tcfdbecode(fdbw->fdb);
+  else if (!wb_apply(wbw, fdb_apply_rec, fdbw->fdb)) {
+    ecode = tcfdbecode(fdbw->fdb);
+    (void)tcfdbtranabort(fdbw->fdb);
+    r = false;
+  }
+  else if (!(r = tcfdbtrancommit(fdbw->fdb)))
+    ecode = tcfdbecode(fdbw->fdb);
+  caml_leave_blocking_section();
+  if (!r) raise_error_exn(ecode, "apply");
+  CAMLreturn(Val_unit);
+}
+
 CAMLprim
 value otoky_fdb_close(value vfdb)
 {
@@ -1254,13 +2254,33 @@ value otoky_fdb_copy(value vfdb, value vpath)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   bool r;
+  scratch pathbuf;
+  scratch_copy_string(&pathbuf, vpath);
   caml_enter_blocking_section();
-  r = tcfdbcopy(fdbw->fdb, String_val(vpath));
+  r = tcfdbcopy(fdbw->fdb, pathbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&pathbuf);
   if (!r) fdb_error(fdbw, "copy");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_fdb_find(value vfdb, value vkey)
+{
+  fdb_wrap *fdbw = fdb_wrap_val(vfdb);
+  void *val;
+  int len;
+  int64 key = Int64_val(vkey);
+  caml_enter_blocking_section();
+  val = tcfdbget(fdbw->fdb, key, &len);
+  caml_leave_blocking_section();
+  if (!val) {
+    if (tcfdbecode(fdbw->fdb) == TCENOREC) return Val_int(0);
+    fdb_error(fdbw, "find");
+  }
+  return make_cstr_option(val, len);
+}
+
 CAMLprim
 value otoky_fdb_fsiz(value vfdb)
 {
@@ -1279,13 +2299,43 @@ value otoky_fdb_get(value vfdb, value vkey)
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   void *val;
   int len;
+  int64 key = Int64_val(vkey);
   caml_enter_blocking_section();
-  val = tcfdbget(fdbw->fdb, Int64_val(vkey), &len);
+  val = tcfdbget(fdbw->fdb, key, &len);
   caml_leave_blocking_section();
   if (!val) fdb_error(fdbw, "get");
   return make_cstr(val, len);
 }
 
+CAMLprim
+value otoky_fdb_get_into(value vfdb, value vkey, value vbuf)
+{
+  CAMLparam1(vbuf);
+  fdb_wrap *fdbw = fdb_wrap_val(vfdb);
+  char *buf = Caml_ba_data_val(vbuf);
+  intnat dim = Caml_ba_array_val(vbuf)->dim[0];
+  int max = (dim > INT_MAX) ? INT_MAX : (int)dim;
+  int len;
+  int64 key = Int64_val(vkey);
+  caml_enter_blocking_section();
+  len = tcfdbget4(fdbw->fdb, key, buf, max);
+  if (len == max) {
+    /*
+      a full buffer may mean the value was truncated; read it again
+      whole, so the length and the bytes come from the same lookup
+    */
+    void *val = tcfdbget(fdbw->fdb, key, &len);
+    if (val) {
+      memcpy(buf, val, (len < max) ? len : max);
+      tcfree(val);
+    }
+    else len = -1;
+  }
+  caml_leave_blocking_section();
+  if (len == -1) fdb_error(fdbw, "get_into");
+  CAMLreturn(Val_int(len));
+}
+
 CAMLprim
 value otoky_fdb_iterinit(value vfdb)
 {
@@ -1310,14 +2360,77 @@ value otoky_fdb_iternext(value vfdb)
   return caml_copy_int64(key);
 }
 
+/* reads up to num records with ids >= lower, in id order */
+CAMLprim
+value otoky_fdb_iter_pairs(value vfdb, value vlower, value vnum)
+{
+  CAMLparam0();
+  CAMLlocal3(vrecs, vval, vpair);
+  fdb_wrap *fdbw = fdb_wrap_val(vfdb);
+  uint64 *ids;
+  void **bufs;
+  int *sizs;
+  int64 lower = Int64_val(vlower);
+  int i, n, m = 0, num = Int_val(vnum);
+  bool err = false;
+
+  if (num <= 0) CAMLreturn(Atom(0));
+
+  caml_enter_blocking_section();
+  ids = tcfdbrange(fdbw->fdb, lower, FDBIDMAX, num, &n);
+  if (ids) {
+    bufs = tcmalloc(n * sizeof(void *));
+    sizs = tcmalloc(n * sizeof(int));
+    for (i = 0; i < n; i++) {
+      /* a record removed since the range was read is skipped */
+      if ((bufs[m] = tcfdbget(fdbw->fdb, ids[i], &sizs[m])))
+        ids[m++] = ids[i];
+      else if (tcfdbecode(fdbw->fdb) != TCENOREC) {
+        err = true;
+        break;
+      }
+    }
+  }
+  caml_leave_blocking_section();
+  if (!ids) fdb_error(fdbw, "fold");
+  if (err) {
+    while (m > 0) tcfree(bufs[--m]);
+    tcfree(bufs);
+    tcfree(sizs);
+    tcfree(ids);
+    fdb_error(fdbw, "fold");
+  }
+
+  if (m == 0)
+    vrecs = Atom(0);
+  else {
+    vrecs = caml_alloc(m, 0);
+    for (i = 0; i < m; i++) {
+      vval = make_cstr(bufs[i], sizs[i]);
+      vpair = caml_alloc_tuple(2);
+      Store_field(vpair, 0, caml_copy_int64(ids[i]));
+      Store_field(vpair, 1, vval);
+      Store_field(vrecs, i, vpair);
+    }
+  }
+  tcfree(bufs);
+  tcfree(sizs);
+  tcfree(ids);
+  CAMLreturn(vrecs);
+}
+
 CAMLprim
 value otoky_fdb_open(value vfdb, value vmode, value vname)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   bool r;
+  int mode = omode_int_of_list(vmode);
+  scratch namebuf;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tcfdbopen(fdbw->fdb, String_val(vname), omode_int_of_list(vmode));
+  r = tcfdbopen(fdbw->fdb, namebuf.ptr, mode);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) fdb_error(fdbw, "open");
   return Val_unit;
 }
@@ -1327,8 +2440,10 @@ value otoky_fdb_optimize(value vfdb, value vwidth, value vlimsiz, value vunit)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   bool r;
+  int32 width = int32_option(vwidth);
+  int64 limsiz = int64_option(vlimsiz);
   caml_enter_blocking_section();
-  r = tcfdboptimize(fdbw->fdb, int32_option(vwidth), int64_option(vlimsiz));
+  r = tcfdboptimize(fdbw->fdb, width, limsiz);
   caml_leave_blocking_section();
   if (!r) fdb_error(fdbw, "optimize");
   return Val_unit;
@@ -1339,8 +2454,9 @@ value otoky_fdb_out(value vfdb, value vkey)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   bool r;
+  int64 key = Int64_val(vkey);
   caml_enter_blocking_section();
-  r = tcfdbout(fdbw->fdb, Int64_val(vkey));
+  r = tcfdbout(fdbw->fdb, key);
   caml_leave_blocking_section();
   if (!r) fdb_error(fdbw, "out");
   return Val_unit;
@@ -1363,37 +2479,94 @@ value otoky_fdb_put(value vfdb, value vkey, value vval, value vlen)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   bool r;
+  int64 key = Int64_val(vkey);
+  scratch valbuf;
+  scratch_copy(&valbuf, vval, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcfdbput(fdbw->fdb, Int64_val(vkey), String_val(vval), Int_val(vlen));
+  r = tcfdbput(fdbw->fdb, key, valbuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&valbuf);
   if (!r) fdb_error(fdbw, "put");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_fdb_put_ba(value vfdb, value vkey, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  fdb_wrap *fdbw = fdb_wrap_val(vfdb);
+  bool r;
+  int64 key = Int64_val(vkey);
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  caml_enter_blocking_section();
+  r = tcfdbput(fdbw->fdb, key, val, Int_val(vlen));
+  caml_leave_blocking_section();
+  if (!r) fdb_error(fdbw, "put_ba");
+  CAMLreturn(Val_unit);
+}
+
 CAMLprim
 value otoky_fdb_putcat(value vfdb, value vkey, value vval, value vlen)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   bool r;
+  int64 key = Int64_val(vkey);
+  scratch valbuf;
+  scratch_copy(&valbuf, vval, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcfdbputcat(fdbw->fdb, Int64_val(vkey), String_val(vval), Int_val(vlen));
+  r = tcfdbputcat(fdbw->fdb, key, valbuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&valbuf);
   if (!r) fdb_error(fdbw, "putcat");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_fdb_putcat_ba(value vfdb, value vkey, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  fdb_wrap *fdbw = fdb_wrap_val(vfdb);
+  bool r;
+  int64 key = Int64_val(vkey);
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  caml_enter_blocking_section();
+  r = tcfdbputcat(fdbw->fdb, key, val, Int_val(vlen));
+  caml_leave_blocking_section();
+  if (!r) fdb_error(fdbw, "putcat_ba");
+  CAMLreturn(Val_unit);
+}
+
 CAMLprim
 value otoky_fdb_putkeep(value vfdb, value vkey, value vval, value vlen)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   bool r;
+  int64 key = Int64_val(vkey);
+  scratch valbuf;
+  scratch_copy(&valbuf, vval, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcfdbputkeep(fdbw->fdb, Int64_val(vkey), String_val(vval), Int_val(vlen));
+  r = tcfdbputkeep(fdbw->fdb, key, valbuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&valbuf);
   if (!r) fdb_error(fdbw, "putkeep");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_fdb_putkeep_ba(value vfdb, value vkey, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  fdb_wrap *fdbw = fdb_wrap_val(vfdb);
+  bool r;
+  int64 key = Int64_val(vkey);
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  caml_enter_blocking_section();
+  r = tcfdbputkeep(fdbw->fdb, key, val, Int_val(vlen));
+  caml_leave_blocking_section();
+  if (!r) fdb_error(fdbw, "putkeep_ba");
+  CAMLreturn(Val_unit);
+}
+
 CAMLprim
 value otoky_fdb_range(value vfdb, value vlower, value vupper, value vmax, value vunit)
 {
@@ -1402,12 +2575,11 @@ value otoky_fdb_range(value vfdb, value vlower, value vupper, value vmax, value
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   uint64 *keys;
   int i, n;
+  int64 lower = (vlower == Val_int(0)) ? FDBIDMIN : Int64_val(Field(vlower, 0));
+  int64 upper = (vupper == Val_int(0)) ? FDBIDMAX : Int64_val(Field(vupper, 0));
+  int max = int_option(vmax);
   caml_enter_blocking_section();
-  keys = tcfdbrange(fdbw->fdb,
-                    ((vlower == Val_int(0)) ? FDBIDMIN : Int64_val(Field(vlower, 0))),
-                    ((vupper == Val_int(0)) ? FDBIDMAX : Int64_val(Field(vupper, 0))),
-                    int_option(vmax),
-                    &n);
+  keys = tcfdbrange(fdbw->fdb, lower, upper, max, &n);
   caml_leave_blocking_section();
   if (!keys) fdb_error(fdbw, "range");
   if (n == 0)
@@ -1417,9 +2589,32 @@ value otoky_fdb_range(value vfdb, value vlower, value vupper, value vmax, value
     for (i = 0; i < n; i++)
       Store_field(vkeys, i, caml_copy_int64(keys[i]));
   }
+  tcfree(keys);
   CAMLreturn(vkeys);
 }
 
+CAMLprim
+value otoky_fdb_range_ba(value vfdb, value vlower, value vupper, value vmax, value vunit)
+{
+  fdb_wrap *fdbw = fdb_wrap_val(vfdb);
+  value vkeys;
+  uint64 *keys;
+  intnat dims[1];
+  int n;
+  int64 lower = (vlower == Val_int(0)) ? FDBIDMIN : Int64_val(Field(vlower, 0));
+  int64 upper = (vupper == Val_int(0)) ? FDBIDMAX : Int64_val(Field(vupper, 0));
+  int max = int_option(vmax);
+  caml_enter_blocking_section();
+  keys = tcfdbrange(fdbw->fdb, lower, upper, max, &n);
+  caml_leave_blocking_section();
+  if (!keys) fdb_error(fdbw, "range_ba");
+  dims[0] = n;
+  vkeys = caml_ba_alloc(CAML_BA_C_LAYOUT | CAML_BA_INT64, 1, NULL, dims);
+  memcpy(Caml_ba_data_val(vkeys), keys, n * sizeof(uint64));
+  tcfree(keys);
+  return vkeys;
+}
+
 CAMLprim
 value otoky_fdb_rnum(value vfdb)
 {
@@ -1485,8 +2680,10 @@ value otoky_fdb_tune(value vfdb, value vwidth, value vlimsiz, value vunit)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   bool r;
+  int32 width = int32_option(vwidth);
+  int64 limsiz = int64_option(vlimsiz);
   caml_enter_blocking_section();
-  r = tcfdbtune(fdbw->fdb, int32_option(vwidth), int64_option(vlimsiz));
+  r = tcfdbtune(fdbw->fdb, width, limsiz);
   caml_leave_blocking_section();
   if (!r) fdb_error(fdbw, "tune");
   return Val_unit;
@@ -1509,8 +2706,9 @@ value otoky_fdb_vsiz(value vfdb, value vkey)
 {
   fdb_wrap *fdbw = fdb_wrap_val(vfdb);
   int r;
+  int64 key = Int64_val(vkey);
   caml_enter_blocking_section();
-  r = tcfdbvsiz(fdbw->fdb, Int64_val(vkey));
+  r = tcfdbvsiz(fdbw->fdb, key);
   caml_leave_blocking_section();
   if (r == -1) fdb_error(fdbw, "vsiz");
   return Val_int(r);
@@ -1529,6 +2727,7 @@ value otoky_fdb_width(value vfdb)
 
 typedef struct hdb_wrap {
   TCHDB *hdb;
+  pthread_mutex_t iter_mtx; /* held by every use of the iterator, which fold_slice borrows */
 } hdb_wrap;
 
 #define hdb_wrap_val(v) (*((hdb_wrap **)(Data_custom_val(v))))
@@ -1540,6 +2739,7 @@ static void hdb_finalize(value vhdb)
   (void)tchdbclose(hdbw->hdb);
   caml_leave_blocking_section();
   tchdbdel(hdbw->hdb);
+  pthread_mutex_destroy(&hdbw->iter_mtx);
   free(hdbw);
 }
 
@@ -1557,6 +2757,7 @@ value otoky_hdb_new(value unit)
   tchdbsetmutex(hdb); /* XXX does this affect performance for single-threaded code? */
   hdbw = caml_stat_alloc(sizeof(hdb_wrap));
   hdbw->hdb = hdb;
+  pthread_mutex_init(&hdbw->iter_mtx, NULL);
   hdb_wrap_val(vhdb) = hdbw;
   return vhdb;
 }
@@ -1566,9 +2767,13 @@ value otoky_hdb_adddouble(value vhdb, value vkey, value vlen, value vnum)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   double num;
+  double inc = Double_val(vnum);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tchdbadddouble(hdbw->hdb, String_val(vkey), Int_val(vlen), Double_val(vnum));
+  num = tchdbadddouble(hdbw->hdb, keybuf.ptr, Int_val(vlen), inc);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (isnan(num)) hdb_error(hdbw, "adddouble");
   return caml_copy_double(num);
 }
@@ -1578,13 +2783,59 @@ value otoky_hdb_addint(value vhdb, value vkey, value vlen, value vnum)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   int num;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tchdbaddint(hdbw->hdb, String_val(vkey), Int_val(vlen), Int_val(vnum));
+  num = tchdbaddint(hdbw->hdb, keybuf.ptr, Int_val(vlen), Int_val(vnum));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (num == INT_MIN) hdb_error(hdbw, "addint");
   return Val_int (num);
 }
 
+static bool hdb_apply_rec(void *db, const wb_head *head, const char *kbuf, const char *vbuf)
+{
+  TCHDB *hdb = db;
+  switch (head->op) {
+  case Wbput:
+    return tchdbput(hdb, kbuf, head->ksiz, vbuf, head->vsiz);
+  case Wbputkeep:
+    /* an existing record isn't a reason to abort the batch */
+    return tchdbputkeep(hdb, kbuf, head->ksiz, vbuf, head->vsiz) || tchdbecode(hdb) == TCEKEEP;
+  case Wbputcat:
+    return tchdbputcat(hdb, kbuf, head->ksiz, vbuf, head->vsiz);
+  case Wbout:
+    return tchdbout(hdb, kbuf, head->ksiz) || tchdbecode(hdb) == TCENOREC;
+  default:
+    tchdbsetecode(hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    return false;
+  }
+}
+
+CAMLprim
+value otoky_hdb_apply(value vhdb, value vwb)
+{
+  CAMLparam1(vwb);
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  wb_wrap *wbw = wb_wrap_val(vwb);
+  int ecode = TCESUCCESS;
+  bool r;
+  caml_enter_blocking_section();
+  r = tchdbtranbegin(hdbw->hdb);
+  if (!r)
+    ecode = tchdbecode(hdbw->hdb);
+  else if (!wb_apply(wbw, hdb_apply_rec, hdbw->hdb)) {
+    ecode = tchdbecode(hdbw->hdb);
+    (void)tchdbtranabort(hdbw->hdb);
+    r = false;
+  }
+  else if (!(r = tchdbtrancommit(hdbw->hdb)))
+    ecode = tchdbecode(hdbw->hdb);
+  caml_leave_blocking_section();
+  if (!r) raise_error_exn(ecode, "apply");
+  CAMLreturn(Val_unit);
+}
+
 CAMLprim
 value otoky_hdb_close(value vhdb)
 {
@@ -1602,13 +2853,35 @@ value otoky_hdb_copy(value vhdb, value vpath)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  scratch pathbuf;
+  scratch_copy_string(&pathbuf, vpath);
   caml_enter_blocking_section();
-  r = tchdbcopy(hdbw->hdb, String_val(vpath));
+  r = tchdbcopy(hdbw->hdb, pathbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&pathbuf);
   if (!r) hdb_error(hdbw, "copy");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_hdb_find(value vhdb, value vkey, value vlen)
+{
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  void *val;
+  int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
+  caml_enter_blocking_section();
+  val = tchdbget(hdbw->hdb, keybuf.ptr, Int_val(vlen), &len);
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!val) {
+    if (tchdbecode(hdbw->hdb) == TCENOREC) return Val_int(0);
+    hdb_error(hdbw, "find");
+  }
+  return make_cstr_option(val, len);
+}
+
 CAMLprim
 value otoky_hdb_fsiz(value vhdb)
 {
@@ -1626,9 +2899,13 @@ TCLIST *otoky_hdb_fwmkeys(value vhdb, value vmax, value vprefix, value vlen)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   TCLIST *tclist;
+  int max = int_option(vmax);
+  scratch prefixbuf;
+  scratch_copy(&prefixbuf, vprefix, Int_val(vlen));
   caml_enter_blocking_section();
-  tclist = tchdbfwmkeys(hdbw->hdb, String_val(vprefix), Int_val(vlen), int_option(vmax));
+  tclist = tchdbfwmkeys(hdbw->hdb, prefixbuf.ptr, Int_val(vlen), max);
   caml_leave_blocking_section();
+  scratch_free(&prefixbuf);
   if (!tclist) hdb_error(hdbw, "fwmkeys");
   return tclist;
 }
@@ -1639,20 +2916,56 @@ value otoky_hdb_get(value vhdb, value vkey, value vlen)
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   void *val;
   int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  val = tchdbget(hdbw->hdb, String_val(vkey), Int_val(vlen), &len);
+  val = tchdbget(hdbw->hdb, keybuf.ptr, Int_val(vlen), &len);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!val) hdb_error(hdbw, "get");
   return make_cstr(val, len);
 }
 
+CAMLprim
+value otoky_hdb_get_into(value vhdb, value vkey, value vlen, value vbuf)
+{
+  CAMLparam1(vbuf);
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  char *buf = Caml_ba_data_val(vbuf);
+  intnat dim = Caml_ba_array_val(vbuf)->dim[0];
+  int max = (dim > INT_MAX) ? INT_MAX : (int)dim;
+  int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
+  caml_enter_blocking_section();
+  len = tchdbget3(hdbw->hdb, keybuf.ptr, Int_val(vlen), buf, max);
+  if (len == max) {
+    /*
+      a full buffer may mean the value was truncated; read it again
+      whole, so the length and the bytes come from the same lookup
+    */
+    void *val = tchdbget(hdbw->hdb, keybuf.ptr, Int_val(vlen), &len);
+    if (val) {
+      memcpy(buf, val, (len < max) ? len : max);
+      tcfree(val);
+    }
+    else len = -1;
+  }
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (len == -1) hdb_error(hdbw, "get_into");
+  CAMLreturn(Val_int(len));
+}
+
 CAMLprim
 value otoky_hdb_iterinit(value vhdb)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
   caml_enter_blocking_section();
+  pthread_mutex_lock(&hdbw->iter_mtx);
   r = tchdbiterinit(hdbw->hdb);
+  pthread_mutex_unlock(&hdbw->iter_mtx);
   caml_leave_blocking_section();
   if (!r) hdb_error(hdbw, "iterinit");
   return Val_unit;
@@ -1665,20 +2978,187 @@ value otoky_hdb_iternext(value vhdb)
   void *key;
   int len;
   caml_enter_blocking_section();
+  pthread_mutex_lock(&hdbw->iter_mtx);
   key = tchdbiternext(hdbw->hdb, &len);
+  pthread_mutex_unlock(&hdbw->iter_mtx);
   caml_leave_blocking_section();
   if (!key) hdb_error(hdbw, "iternext");
   return make_cstr(key, len);
 }
 
+/* the method lock tchdbsetmutex installs, held around direct reads of the handle */
+static void hdb_lock(TCHDB *hdb)
+{
+  if (hdb->mmtx) pthread_rwlock_wrlock((pthread_rwlock_t *)hdb->mmtx);
+}
+
+static void hdb_unlock(TCHDB *hdb)
+{
+  if (hdb->mmtx) pthread_rwlock_unlock((pthread_rwlock_t *)hdb->mmtx);
+}
+
+/*
+  reads up to num records from the iterator, keys and values
+  together, stopping at file offset end. end is a record boundary, so
+  a record read from before it ends at or before it. if cur is given,
+  reads from *cur instead and advances it, leaving the handle's own
+  iterator where it was.
+*/
+static value hdb_iter_pairs(hdb_wrap *hdbw, uint64 *cur, uint64 end, int num, const char *fn_name)
+{
+  TCHDB *hdb = hdbw->hdb;
+  TCXSTR *kxstr, *vxstr;
+  void **bufs;
+  int *sizs;
+  int n = 0;
+  bool err = false;
+  uint64 iter = 0;
+  value vrecs;
+
+  if (num <= 0) return Atom(0);
+
+  bufs = tcmalloc(2 * num * sizeof(void *));
+  sizs = tcmalloc(2 * num * sizeof(int));
+  kxstr = tcxstrnew();
+  vxstr = tcxstrnew();
+  caml_enter_blocking_section();
+  pthread_mutex_lock(&hdbw->iter_mtx);
+  if (cur) {
+    hdb_lock(hdb);
+    iter = hdb->iter;
+    hdb->iter = *cur < hdb->frec ? hdb->frec : *cur;
+    hdb_unlock(hdb);
+  }
+  for (; n < num && hdb->iter < end; n++) {
+    tcxstrclear(kxstr);
+    tcxstrclear(vxstr);
+    if (!tchdbiternext3(hdb, kxstr, vxstr)) {
+      err = tchdbecode(hdb) != TCENOREC;
+      break;
+    }
+    if (hdb->iter > end) {
+      /* skipped free blocks onto the next slice's first record */
+      hdb->iter = end;
+      break;
+    }
+    sizs[2 * n] = TCXSTRSIZE(kxstr);
+    bufs[2 * n] = tcmemdup(TCXSTRPTR(kxstr), TCXSTRSIZE(kxstr));
+    sizs[2 * n + 1] = TCXSTRSIZE(vxstr);
+    bufs[2 * n + 1] = tcmemdup(TCXSTRPTR(vxstr), TCXSTRSIZE(vxstr));
+  }
+  if (cur) {
+    hdb_lock(hdb);
+    *cur = hdb->iter;
+    hdb->iter = iter;
+    hdb_unlock(hdb);
+  }
+  pthread_mutex_unlock(&hdbw->iter_mtx);
+  caml_leave_blocking_section();
+  tcxstrdel(kxstr);
+  tcxstrdel(vxstr);
+
+  if (err) {
+    while (n > 0) {
+      n--;
+      tcfree(bufs[2 * n]);
+      tcfree(bufs[2 * n + 1]);
+    }
+    tcfree(bufs);
+    tcfree(sizs);
+    hdb_error(hdbw, fn_name);
+  }
+
+  vrecs = make_cstr_pairs(n, bufs, sizs);
+  tcfree(bufs);
+  tcfree(sizs);
+  return vrecs;
+}
+
+CAMLprim
+value otoky_hdb_iter_pairs(value vhdb, value vnum)
+{
+  return hdb_iter_pairs(hdb_wrap_val(vhdb), NULL, UINT64_MAX, Int_val(vnum), "fold");
+}
+
+CAMLprim
+value otoky_hdb_mget(value vhdb, value vkeys)
+{
+  CAMLparam1(vkeys);
+  CAMLlocal2(vvals, vcstr);
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  int i, num = Wosize_val(vkeys);
+  int ecode = TCESUCCESS;
+  char *kbuf, *kp;
+  int *ksizs, *vsizs;
+  void **vals;
+
+  if (num == 0) CAMLreturn(Atom(0));
+
+  /* the keys are copied out so we don't touch the OCaml heap in the blocking section */
+  ksizs = tcmalloc(num * sizeof(int));
+  vsizs = tcmalloc(num * sizeof(int));
+  vals = tcmalloc(num * sizeof(void *));
+  kbuf = copy_cstr_array(vkeys, num, ksizs);
+  if (!kbuf) {
+    tcfree(ksizs);
+    tcfree(vsizs);
+    tcfree(vals);
+    tchdbsetecode(hdbw->hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    hdb_error(hdbw, "mget");
+  }
+
+  caml_enter_blocking_section();
+  for (i = 0, kp = kbuf; i < num; kp += ksizs[i], i++) {
+    vals[i] = tchdbget(hdbw->hdb, kp, ksizs[i], &vsizs[i]);
+    if (!vals[i] && (ecode = tchdbecode(hdbw->hdb)) != TCENOREC) break;
+  }
+  caml_leave_blocking_section();
+
+  tcfree(kbuf);
+  tcfree(ksizs);
+  if (i < num) {
+    while (i > 0) tcfree(vals[--i]);
+    tcfree(vals);
+    tcfree(vsizs);
+    raise_error_exn(ecode, "mget");
+  }
+
+  vvals = caml_alloc(num, 0);
+  for (i = 0; i < num; i++) {
+    if (vals[i]) {
+      vcstr = make_cstr_option(vals[i], vsizs[i]);
+      Store_field(vvals, i, vcstr);
+    }
+  }
+  tcfree(vals);
+  tcfree(vsizs);
+  CAMLreturn(vvals);
+}
+
+CAMLprim
+value otoky_hdb_opaque(value vhdb)
+{
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  value vopaque;
+  char *opaque = tchdbopaque(hdbw->hdb);
+  if (!opaque) hdb_error(hdbw, "opaque");
+  vopaque = caml_alloc_string(HDB_OPAQUE_SIZ);
+  memcpy(String_val(vopaque), opaque, HDB_OPAQUE_SIZ);
+  return vopaque;
+}
+
 CAMLprim
 value otoky_hdb_open(value vhdb, value vmode, value vname)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  int mode = omode_int_of_list(vmode);
+  scratch namebuf;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tchdbopen(hdbw->hdb, String_val(vname), omode_int_of_list(vmode));
+  r = tchdbopen(hdbw->hdb, namebuf.ptr, mode);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) hdb_error(hdbw, "open");
   return Val_unit;
 }
@@ -1688,9 +3168,12 @@ value otoky_hdb_optimize(value vhdb, value vbnum, value vapow, value vfpow, valu
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  int64 bnum = int64_option(vbnum);
+  int apow = int_option(vapow);
+  int fpow = int_option(vfpow);
+  int opts = opt_int_of_list(vopts);
   caml_enter_blocking_section();
-  r = tchdboptimize(hdbw->hdb,
-                    int64_option(vbnum), int_option(vapow), int_option(vfpow), opt_int_of_list(vopts));
+  r = tchdboptimize(hdbw->hdb, bnum, apow, fpow, opts);
   caml_leave_blocking_section();
   if (!r) hdb_error(hdbw, "optimize");
   return Val_unit;
@@ -1707,13 +3190,68 @@ value otoky_hdb_out(value vhdb, value vkey, value vlen)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tchdbout(hdbw->hdb, String_val(vkey), Int_val(vlen));
+  r = tchdbout(hdbw->hdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) hdb_error(hdbw, "out");
   return Val_unit;
 }
 
+/*
+  offsets splitting the records into up to num slices: the first
+  record, then the start of the first record at or after each
+  num-th of the file, then the end of the file. bucket heads are
+  record starts, so the boundaries are taken from the bucket array,
+  under the method lock so writers on the handle can't move them.
+*/
+CAMLprim
+value otoky_hdb_partition(value vhdb, value vnum)
+{
+  CAMLparam0();
+  CAMLlocal1(vbounds);
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  TCHDB *hdb = hdbw->hdb;
+  int num = Int_val(vnum);
+  uint64 *bounds = tcmalloc((num + 1) * sizeof(uint64));
+  uint64 i, off, frec, fsiz;
+  int j, n;
+
+  if (!tchdbpath(hdb)) {
+    tcfree(bounds);
+    hdb_error(hdbw, "partition");
+  }
+
+  for (j = 1; j < num; j++) bounds[j] = UINT64_MAX;
+  caml_enter_blocking_section();
+  hdb_lock(hdb);
+  frec = hdb->frec;
+  fsiz = hdb->fsiz;
+  for (i = 0; i < hdb->bnum; i++) {
+    off = hdb->ba64 ? TCITOHLL(hdb->ba64[i]) : TCITOHL(hdb->ba32[i]);
+    if (off == 0) continue;
+    off <<= hdb->apow;
+    for (j = 1; j < num; j++)
+      if (off >= frec + (fsiz - frec) / num * j && off < bounds[j]) bounds[j] = off;
+  }
+  hdb_unlock(hdb);
+  caml_leave_blocking_section();
+
+  bounds[0] = frec;
+  n = 1;
+  for (j = 1; j < num; j++)
+    if (bounds[j] < fsiz && bounds[j] > bounds[n - 1]) bounds[n++] = bounds[j];
+  bounds[n++] = fsiz;
+
+  vbounds = caml_alloc(n, 0);
+  for (j = 0; j < n; j++)
+    Store_field(vbounds, j, caml_copy_int64(bounds[j]));
+  tcfree(bounds);
+  CAMLreturn(vbounds);
+}
+
 CAMLprim
 value otoky_hdb_path(value vhdb)
 {
@@ -1731,21 +3269,54 @@ value otoky_hdb_put(value vhdb, value vkey, value vkeylen, value vval, value vva
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tchdbput(hdbw->hdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tchdbput(hdbw->hdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) hdb_error(hdbw, "put");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_hdb_put_ba(value vhdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tchdbput(hdbw->hdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) hdb_error(hdbw, "put_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_hdb_put_ba_bc(value *argv, int argn)
+{
+  return otoky_hdb_put_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_hdb_putasync(value vhdb, value vkey, value vkeylen, value vval, value vvallen)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tchdbputasync(hdbw->hdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tchdbputasync(hdbw->hdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) hdb_error(hdbw, "putasync");
   return Val_unit;
 }
@@ -1755,25 +3326,81 @@ value otoky_hdb_putcat(value vhdb, value vkey, value vkeylen, value vval, value
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tchdbputcat(hdbw->hdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tchdbputcat(hdbw->hdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) hdb_error(hdbw, "putcat");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_hdb_putcat_ba(value vhdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tchdbputcat(hdbw->hdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) hdb_error(hdbw, "putcat_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_hdb_putcat_ba_bc(value *argv, int argn)
+{
+  return otoky_hdb_putcat_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_hdb_putkeep(value vhdb, value vkey, value vkeylen, value vval, value vvallen)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tchdbputkeep(hdbw->hdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tchdbputkeep(hdbw->hdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) hdb_error(hdbw, "putkeep");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_hdb_putkeep_ba(value vhdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tchdbputkeep(hdbw->hdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) hdb_error(hdbw, "putkeep_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_hdb_putkeep_ba_bc(value *argv, int argn)
+{
+  return otoky_hdb_putkeep_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_hdb_rnum(value vhdb)
 {
@@ -1786,13 +3413,29 @@ value otoky_hdb_rnum(value vhdb)
   return caml_copy_int64(r);
 }
 
+/*
+  reads a slice through the handle itself, from the cursor in vcur,
+  so the handle's locks, unsynced records and file size all apply.
+*/
+CAMLprim
+value otoky_hdb_slice_pairs(value vhdb, value vcur, value vend, value vnum)
+{
+  CAMLparam1(vcur);
+  CAMLlocal1(vrecs);
+  uint64 cur = Int64_val(Field(vcur, 0));
+  vrecs = hdb_iter_pairs(hdb_wrap_val(vhdb), &cur, Int64_val(vend), Int_val(vnum), "fold_slice");
+  Store_field(vcur, 0, caml_copy_int64(cur));
+  CAMLreturn(vrecs);
+}
+
 CAMLprim
 value otoky_hdb_setcache(value vhdb, value vrcnum)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  int32 rcnum = Int32_val(vrcnum);
   caml_enter_blocking_section();
-  r = tchdbsetcache(hdbw->hdb, Int32_val(vrcnum));
+  r = tchdbsetcache(hdbw->hdb, rcnum);
   caml_leave_blocking_section();
   if (!r) hdb_error(hdbw, "setcache");
   return Val_unit;
@@ -1803,20 +3446,37 @@ value otoky_hdb_setdfunit(value vhdb, value vdfunit)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  int32 dfunit = Int32_val(vdfunit);
   caml_enter_blocking_section();
-  r = tchdbsetdfunit(hdbw->hdb, Int32_val(vdfunit));
+  r = tchdbsetdfunit(hdbw->hdb, dfunit);
   caml_leave_blocking_section();
   if (!r) hdb_error(hdbw, "setdfunit");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_hdb_setopaque(value vhdb, value voff, value vstr)
+{
+  hdb_wrap *hdbw = hdb_wrap_val(vhdb);
+  char *opaque = tchdbopaque(hdbw->hdb);
+  if (!opaque) hdb_error(hdbw, "setopaque");
+  /* a reader's header is mapped read-only */
+  if (!(hdbw->hdb->omode & HDBOWRITER)) {
+    tchdbsetecode(hdbw->hdb, TCEINVALID, __FILE__, __LINE__, __func__);
+    hdb_error(hdbw, "setopaque");
+  }
+  memcpy(opaque + Int_val(voff), String_val(vstr), caml_string_length(vstr));
+  return Val_unit;
+}
+
 CAMLprim
 value otoky_hdb_setxmsiz(value vhdb, value vxmsiz)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  int64 xmsiz = Int64_val(vxmsiz);
   caml_enter_blocking_section();
-  r = tchdbsetxmsiz(hdbw->hdb, Int64_val(vxmsiz));
+  r = tchdbsetxmsiz(hdbw->hdb, xmsiz);
   caml_leave_blocking_section();
   if (!r) hdb_error(hdbw, "setxmsiz");
   return Val_unit;
@@ -1875,9 +3535,12 @@ value otoky_hdb_tune(value vhdb, value vbnum, value vapow, value vfpow, value vo
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   bool r;
+  int64 bnum = int64_option(vbnum);
+  int apow = int_option(vapow);
+  int fpow = int_option(vfpow);
+  int opts = opt_int_of_list(vopts);
   caml_enter_blocking_section();
-  r = tchdbtune(hdbw->hdb,
-                int64_option(vbnum), int_option(vapow), int_option(vfpow), opt_int_of_list(vopts));
+  r = tchdbtune(hdbw->hdb, bnum, apow, fpow, opts);
   caml_leave_blocking_section();
   if (!r) hdb_error(hdbw, "tune");
   return Val_unit;
@@ -1906,9 +3569,12 @@ value otoky_hdb_vsiz(value vhdb, value vkey, value vlen)
 {
   hdb_wrap *hdbw = hdb_wrap_val(vhdb);
   int r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tchdbvsiz(hdbw->hdb, String_val(vkey), Int_val(vlen));
+  r = tchdbvsiz(hdbw->hdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (r == -1) hdb_error(hdbw, "vsiz");
   return Val_int(r);
 }
@@ -1963,9 +3629,13 @@ value otoky_tdb_adddouble(value vtdb, value vkey, value vlen, value vnum)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   double num;
+  double inc = Double_val(vnum);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tctdbadddouble(tdbw->tdb, String_val(vkey), Int_val(vlen), Double_val(vnum));
+  num = tctdbadddouble(tdbw->tdb, keybuf.ptr, Int_val(vlen), inc);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (isnan(num)) tdb_error(tdbw, "adddouble");
   return caml_copy_double(num);
 }
@@ -1975,9 +3645,12 @@ value otoky_tdb_addint(value vtdb, value vkey, value vlen, value vnum)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   int num;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tctdbaddint(tdbw->tdb, String_val(vkey), Int_val(vlen), Int_val(vnum));
+  num = tctdbaddint(tdbw->tdb, keybuf.ptr, Int_val(vlen), Int_val(vnum));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (num == INT_MIN) tdb_error(tdbw, "addint");
   return Val_int (num);
 }
@@ -1999,13 +3672,37 @@ value otoky_tdb_copy(value vtdb, value vpath)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  scratch pathbuf;
+  scratch_copy_string(&pathbuf, vpath);
   caml_enter_blocking_section();
-  r = tctdbcopy(tdbw->tdb, String_val(vpath));
+  r = tctdbcopy(tdbw->tdb, pathbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&pathbuf);
   if (!r) tdb_error(tdbw, "copy");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_tdb_find(value vtdb, value vkey, value vlen)
+{
+  tdb_wrap *tdbw = tdb_wrap_val(vtdb);
+  TCMAP *tcmap;
+  value vsome;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
+  caml_enter_blocking_section();
+  tcmap = tctdbget(tdbw->tdb, keybuf.ptr, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!tcmap) {
+    if (tctdbecode(tdbw->tdb) == TCENOREC) return Val_int(0);
+    tdb_error(tdbw, "find");
+  }
+  vsome = caml_alloc_small(1, 0);
+  Field(vsome, 0) = (value)tcmap;
+  return vsome;
+}
+
 CAMLprim
 value otoky_tdb_fsiz(value vtdb)
 {
@@ -2023,9 +3720,13 @@ TCLIST *otoky_tdb_fwmkeys(value vtdb, value vmax, value vprefix, value vlen)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   TCLIST *tclist;
+  int max = int_option(vmax);
+  scratch prefixbuf;
+  scratch_copy(&prefixbuf, vprefix, Int_val(vlen));
   caml_enter_blocking_section();
-  tclist = tctdbfwmkeys(tdbw->tdb, String_val(vprefix), Int_val(vlen), int_option(vmax));
+  tclist = tctdbfwmkeys(tdbw->tdb, prefixbuf.ptr, Int_val(vlen), max);
   caml_leave_blocking_section();
+  scratch_free(&prefixbuf);
   if (!tclist) tdb_error(tdbw, "fwmkeys");
   return tclist;
 }
@@ -2047,9 +3748,12 @@ TCMAP *otoky_tdb_get(value vtdb, value vkey, value vlen)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   TCMAP *tcmap;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  tcmap = tctdbget(tdbw->tdb, String_val(vkey), Int_val(vlen));
+  tcmap = tctdbget(tdbw->tdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!tcmap) tdb_error(tdbw, "get");
   return tcmap;
 }
@@ -2079,14 +3783,85 @@ value otoky_tdb_iternext(value vtdb)
   return make_cstr(key, len);
 }
 
+/* reads up to num records from the iterator, primary keys with their columns */
+CAMLprim
+value otoky_tdb_iter_pairs(value vtdb, value vnum)
+{
+  CAMLparam0();
+  CAMLlocal3(vrecs, vkey, vpair);
+  tdb_wrap *tdbw = tdb_wrap_val(vtdb);
+  void **keys;
+  int *sizs;
+  TCMAP **cols;
+  int i, n = 0, num = Int_val(vnum);
+  bool err = false;
+
+  if (num <= 0) CAMLreturn(Atom(0));
+
+  keys = tcmalloc(num * sizeof(void *));
+  sizs = tcmalloc(num * sizeof(int));
+  cols = tcmalloc(num * sizeof(TCMAP *));
+  caml_enter_blocking_section();
+  while (n < num) {
+    if (!(keys[n] = tctdbiternext(tdbw->tdb, &sizs[n]))) {
+      err = tctdbecode(tdbw->tdb) != TCENOREC;
+      break;
+    }
+    /* a record removed since the iterator passed it is skipped */
+    if ((cols[n] = tctdbget(tdbw->tdb, keys[n], sizs[n])))
+      n++;
+    else {
+      tcfree(keys[n]);
+      if (tctdbecode(tdbw->tdb) != TCENOREC) {
+        err = true;
+        break;
+      }
+    }
+  }
+  caml_leave_blocking_section();
+
+  if (err) {
+    while (n > 0) {
+      n--;
+      tcfree(keys[n]);
+      tcmapdel(cols[n]);
+    }
+    tcfree(keys);
+    tcfree(sizs);
+    tcfree(cols);
+    tdb_error(tdbw, "fold");
+  }
+
+  if (n == 0)
+    vrecs = Atom(0);
+  else {
+    vrecs = caml_alloc(n, 0);
+    for (i = 0; i < n; i++) {
+      vkey = make_cstr(keys[i], sizs[i]);
+      vpair = caml_alloc_tuple(2);
+      Store_field(vpair, 0, vkey);
+      Field(vpair, 1) = (value)cols[i];
+      Store_field(vrecs, i, vpair);
+    }
+  }
+  tcfree(keys);
+  tcfree(sizs);
+  tcfree(cols);
+  CAMLreturn(vrecs);
+}
+
 CAMLprim
 value otoky_tdb_open(value vtdb, value vmode, value vname)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  int mode = omode_int_of_list(vmode);
+  scratch namebuf;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tctdbopen(tdbw->tdb, String_val(vname), omode_int_of_list(vmode));
+  r = tctdbopen(tdbw->tdb, namebuf.ptr, mode);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) tdb_error(tdbw, "open");
   return Val_unit;
 }
@@ -2096,9 +3871,12 @@ value otoky_tdb_optimize(value vtdb, value vbnum, value vapow, value vfpow, valu
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  int64 bnum = int64_option(vbnum);
+  int apow = int_option(vapow);
+  int fpow = int_option(vfpow);
+  int opts = opt_int_of_list(vopts);
   caml_enter_blocking_section();
-  r = tctdboptimize(tdbw->tdb,
-                    int64_option(vbnum), int_option(vapow), int_option(vfpow), opt_int_of_list(vopts));
+  r = tctdboptimize(tdbw->tdb, bnum, apow, fpow, opts);
   caml_leave_blocking_section();
   if (!r) tdb_error(tdbw, "optimize");
   return Val_unit;
@@ -2115,9 +3893,12 @@ value otoky_tdb_out(value vtdb, value vkey, value vlen)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tctdbout(tdbw->tdb, String_val(vkey), Int_val(vlen));
+  r = tctdbout(tdbw->tdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) tdb_error(tdbw, "out");
   return Val_unit;
 }
@@ -2139,9 +3920,12 @@ value otoky_tdb_put(value vtdb, value vkey, value vkeylen, TCMAP *tcmap)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
   caml_enter_blocking_section();
-  r = tctdbput(tdbw->tdb, String_val(vkey), Int_val(vkeylen), tcmap);
+  r = tctdbput(tdbw->tdb, keybuf.ptr, Int_val(vkeylen), tcmap);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) tdb_error(tdbw, "put");
   return Val_unit;
 }
@@ -2151,9 +3935,12 @@ value otoky_tdb_putcat(value vtdb, value vkey, value vkeylen, TCMAP *tcmap)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
   caml_enter_blocking_section();
-  r = tctdbputcat(tdbw->tdb, String_val(vkey), Int_val(vkeylen), tcmap);
+  r = tctdbputcat(tdbw->tdb, keybuf.ptr, Int_val(vkeylen), tcmap);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) tdb_error(tdbw, "putcat");
   return Val_unit;
 }
@@ -2163,9 +3950,12 @@ value otoky_tdb_putkeep(value vtdb, value vkey, value vkeylen, TCMAP *tcmap)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
   caml_enter_blocking_section();
-  r = tctdbputkeep(tdbw->tdb, String_val(vkey), Int_val(vkeylen), tcmap);
+  r = tctdbputkeep(tdbw->tdb, keybuf.ptr, Int_val(vkeylen), tcmap);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) tdb_error(tdbw, "putkeep");
   return Val_unit;
 }
@@ -2187,8 +3977,11 @@ value otoky_tdb_setcache(value vtdb, value vrcnum, value vlcnum, value vncnum, v
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  int32 rcnum = int32_option(vrcnum);
+  int32 lcnum = int32_option(vlcnum);
+  int32 ncnum = int32_option(vncnum);
   caml_enter_blocking_section();
-  r = tctdbsetcache(tdbw->tdb, int32_option(vrcnum), int32_option(vlcnum), int32_option(vncnum));
+  r = tctdbsetcache(tdbw->tdb, rcnum, lcnum, ncnum);
   caml_leave_blocking_section();
   if (!r) tdb_error(tdbw, "setcache");
   return Val_unit;
@@ -2199,8 +3992,9 @@ value otoky_tdb_setdfunit(value vtdb, value vdfunit)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  int32 dfunit = Int32_val(vdfunit);
   caml_enter_blocking_section();
-  r = tctdbsetdfunit(tdbw->tdb, Int32_val(vdfunit));
+  r = tctdbsetdfunit(tdbw->tdb, dfunit);
   caml_leave_blocking_section();
   if (!r) tdb_error(tdbw, "setdfunit");
   return Val_unit;
@@ -2214,6 +4008,7 @@ value otoky_tdb_setindex(value vtdb, value vname, value vkeep, value vitype)
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
   int itype = 0;
+  scratch namebuf;
   switch (Int_val(vitype)) {
   case It_lexical: itype = TDBITLEXICAL; break;
   case It_decimal: itype = TDBITDECIMAL; break;
@@ -2223,9 +4018,11 @@ value otoky_tdb_setindex(value vtdb, value vname, value vkeep, value vitype)
   case It_void:    itype = TDBITVOID;    break;
   }
   if (bool_option(vkeep)) itype |= TDBITKEEP;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tctdbsetindex(tdbw->tdb, String_val(vname), itype);
+  r = tctdbsetindex(tdbw->tdb, namebuf.ptr, itype);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) tdb_error(tdbw, "setdfunit");
   return Val_unit;
 }
@@ -2235,8 +4032,9 @@ value otoky_tdb_setxmsiz(value vtdb, value vxmsiz)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  int64 xmsiz = Int64_val(vxmsiz);
   caml_enter_blocking_section();
-  r = tctdbsetxmsiz(tdbw->tdb, Int64_val(vxmsiz));
+  r = tctdbsetxmsiz(tdbw->tdb, xmsiz);
   caml_leave_blocking_section();
   if (!r) tdb_error(tdbw, "setxmsiz");
   return Val_unit;
@@ -2295,9 +4093,12 @@ value otoky_tdb_tune(value vtdb, value vbnum, value vapow, value vfpow, value vo
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   bool r;
+  int64 bnum = int64_option(vbnum);
+  int apow = int_option(vapow);
+  int fpow = int_option(vfpow);
+  int opts = opt_int_of_list(vopts);
   caml_enter_blocking_section();
-  r = tctdbtune(tdbw->tdb,
-                int64_option(vbnum), int_option(vapow), int_option(vfpow), opt_int_of_list(vopts));
+  r = tctdbtune(tdbw->tdb, bnum, apow, fpow, opts);
   caml_leave_blocking_section();
   if (!r) tdb_error(tdbw, "tune");
   return Val_unit;
@@ -2326,9 +4127,12 @@ value otoky_tdb_vsiz(value vtdb, value vkey, value vlen)
 {
   tdb_wrap *tdbw = tdb_wrap_val(vtdb);
   int r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tctdbvsiz(tdbw->tdb, String_val(vkey), Int_val(vlen));
+  r = tctdbvsiz(tdbw->tdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (r == -1) tdb_error(tdbw, "vsiz");
   return Val_int(r);
 }
@@ -2382,7 +4186,8 @@ value otoky_tdbqry_addcond(value vtdbqry, value vname, value vnegate, value vnoi
 {
   tdbqry_wrap *tdbqryw = tdbqry_wrap_val(vtdbqry);
   int op = 0;
-  switch (Int_val(op)) {
+  scratch namebuf, exprbuf;
+  switch (Int_val(vop)) {
   case Qc_streq:   op = TDBQCSTREQ;   break;
   case Qc_strinc:  op = TDBQCSTRINC;  break;
   case Qc_strbw:   op = TDBQCSTRBW;   break;
@@ -2405,9 +4210,13 @@ value otoky_tdbqry_addcond(value vtdbqry, value vname, value vnegate, value vnoi
   }
   if (bool_option(vnegate)) op |= TDBQCNEGATE;
   if (bool_option(vnoidx)) op |= TDBQCNOIDX;
+  scratch_copy_string(&namebuf, vname);
+  scratch_copy_string(&exprbuf, vexpr);
   caml_enter_blocking_section();
-  tctdbqryaddcond(tdbqryw->tdbqry, String_val(vname), op, String_val(vexpr));
+  tctdbqryaddcond(tdbqryw->tdbqry, namebuf.ptr, op, exprbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
+  scratch_free(&exprbuf);
   return Val_unit;
 }
 
@@ -2433,6 +4242,7 @@ TCLIST *otoky_tdbqry_kwic(value vtdbqry, value vname, value vwidth, value vopts,
   TCLIST *tclist;
   int width = int_option(vwidth);
   int opts = 0;
+  scratch namebuf;
   for (; vopts != Val_int(0); vopts = Field(vopts, 1)) {
     switch (Int_val(Field(vopts, 0))) {
     case Kw_mutab:  opts |= TCKWMUTAB;  break;
@@ -2446,9 +4256,11 @@ TCLIST *otoky_tdbqry_kwic(value vtdbqry, value vname, value vwidth, value vopts,
     width = 1 << 30;
     opts |= TCKWNOOVER | TCKWPULEAD;
   }
+  scratch_copy_string_option(&namebuf, vname);
   caml_enter_blocking_section();
-  tclist = tctdbqrykwic(tdbqryw->tdbqry, tcmap, string_option(vname), width, opts);
+  tclist = tctdbqrykwic(tdbqryw->tdbqry, tcmap, namebuf.ptr, width, opts);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!tclist) tdbqry_error(tdbqryw, "kwic");
   return tclist;
 }
@@ -5,7 +5,11 @@ struct
 
   external del : t -> unit = "otoky_cstr_del"
   external to_bigarray : t -> buf = "otoky_cstr_to_bigarray"
-  external of_bigarray : ?len:int -> buf -> t = "otoky_cstr_of_bigarray"
+  external _of_bigarray : buf -> string = "otoky_cstr_of_bigarray"
+
+  let check_buf buf off len fn =
+    if off < 0 || len < 0 || off > Bigarray.Array1.dim buf - len
+    then invalid_arg fn
 
   let copy (s, len) =
     let r = String.create len in
@@ -14,6 +18,16 @@ struct
 
   let of_string s =
     s, String.length s
+
+  let of_bigarray buf len =
+    check_buf buf 0 len "of_bigarray";
+    _of_bigarray buf, len
+
+  let hash (s, len) =
+    let rec loop h i =
+      if i = len then h
+      else loop (((h lxor Char.code (String.unsafe_get s i)) * 16777619) land 0x3fffffff) (i + 1) in
+    loop 0x011c9dc5 0
 end
 
 module type Cstr_t =
@@ -5,9 +5,15 @@ sig
 
   external del : t -> unit = "otoky_cstr_del"
   external to_bigarray : t -> buf = "otoky_cstr_to_bigarray"
-  external of_bigarray : ?len:int -> buf -> t = "otoky_cstr_of_bigarray"
+  val check_buf : buf -> int -> int -> string -> unit
   val copy : t -> string
   val of_string : string -> t
+
+  (* the first len bytes of buf, without copying; valid only while buf is reachable, and not to be del'd *)
+  val of_bigarray : buf -> int -> t
+
+  (* FNV-1a truncated to 30 bits, so it places keys the same way on every platform *)
+  val hash : t -> int
 end
 
 module type Cstr_t =
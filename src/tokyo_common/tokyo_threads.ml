@@ -0,0 +1,22 @@
+type 'a outcome = Value of 'a | Exn of exn
+
+let outcome f = try Value (f ()) with e -> Exn e
+
+let value = function
+  | Value v -> v
+  | Exn e -> raise e
+
+type 'a thread = Thread.t * 'a outcome option ref
+
+let spawn f =
+  let r = ref None in
+  let th = Thread.create (fun () -> r := Some (outcome f)) () in
+  (th, r)
+
+let join (th, r) =
+  Thread.join th;
+  match !r with
+    | Some o -> o
+    | None -> Exn (Failure "Tokyo_threads.join: thread exited without a result") (* Thread.exit in f *)
+
+let join_all ths = List.map value (List.map join ths)
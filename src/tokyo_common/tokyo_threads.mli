@@ -0,0 +1,23 @@
+(*
+  running calls on system threads and collecting their results,
+  shared by the thread-using parts of the other packages.
+*)
+
+(* the result of a call: its value, or the exception it raised *)
+type 'a outcome = Value of 'a | Exn of exn
+
+val outcome : (unit -> 'a) -> 'a outcome
+
+(* the value, or raise the exception *)
+val value : 'a outcome -> 'a
+
+type 'a thread
+
+(* f () on a new thread *)
+val spawn : (unit -> 'a) -> 'a thread
+
+(* waits for the thread to finish *)
+val join : 'a thread -> 'a outcome
+
+(* waits for every thread, then raises the first failure in list order *)
+val join_all : 'a thread list -> 'a list
@@ -0,0 +1,185 @@
+open Tokyo_tyrant
+
+type t = {
+  host : string;
+  port : int;
+  size : int;
+  timeout : float option;
+  check_idle : float;
+  m : Mutex.t;
+  c : Condition.t;
+  mutable free : (RDB.t * float) list; (* with the time each came back *)
+  mutable opened : int;
+  mutable closed : bool;
+  threads : (int, RDB.t) Hashtbl.t;
+  mutable wait_time : float;
+  mutable waits : int;
+}
+
+let create ?(size = 8) ?timeout ?(check_idle = 30.) host port =
+  if size <= 0 then invalid_arg "create";
+  {
+    host = host;
+    port = port;
+    size = size;
+    timeout = timeout;
+    check_idle = check_idle;
+    m = Mutex.create ();
+    c = Condition.create ();
+    free = [];
+    opened = 0;
+    closed = false;
+    threads = Hashtbl.create 17;
+    wait_time = 0.;
+    waits = 0;
+  }
+
+let close_quietly rdb = try RDB.close rdb with _ -> ()
+
+let close t =
+  Mutex.lock t.m;
+  let free = t.free in
+  t.closed <- true;
+  t.free <- [];
+  t.opened <- t.opened - List.length free;
+  Condition.broadcast t.c;
+  Mutex.unlock t.m;
+  List.iter (fun (rdb, _) -> close_quietly rdb) free
+
+let open_rdb t =
+  let rdb = RDB.new_ () in
+  RDB.tune rdb ?timeout:t.timeout ~topts:[Trecon] ();
+  RDB.open_ rdb t.host t.port;
+  rdb
+
+let checkout t =
+  Mutex.lock t.m;
+  let rec get waited =
+    if t.closed then begin
+      Mutex.unlock t.m;
+      invalid_arg "checkout"
+    end;
+    match t.free with
+      | idle :: rdbs ->
+          t.free <- rdbs;
+          Some idle
+      | [] when t.opened < t.size ->
+          t.opened <- t.opened + 1;
+          None
+      | [] ->
+          let t0 = Unix.gettimeofday () in
+          Condition.wait t.c t.m;
+          t.wait_time <- t.wait_time +. (Unix.gettimeofday () -. t0);
+          if not waited then t.waits <- t.waits + 1;
+          get true in
+  (* None: room to open a new connection *)
+  let r = get false in
+  Mutex.unlock t.m;
+  let fresh () =
+    try open_rdb t
+    with e ->
+      Mutex.lock t.m;
+      t.opened <- t.opened - 1;
+      Condition.signal t.c;
+      Mutex.unlock t.m;
+      raise e in
+  match r with
+    | Some (rdb, since) when Unix.gettimeofday () -. since < t.check_idle -> rdb
+    | Some (rdb, _) ->
+        (* idle a while, so the server may have dropped it; replace it if it doesn't answer *)
+        begin
+          try ignore (RDB.stat rdb); rdb
+          with _ -> close_quietly rdb; fresh ()
+        end
+    | None -> fresh ()
+
+let checkin t rdb =
+  Mutex.lock t.m;
+  if t.closed
+  then begin
+    t.opened <- t.opened - 1;
+    Mutex.unlock t.m;
+    close_quietly rdb
+  end
+  else begin
+    t.free <- (rdb, Unix.gettimeofday ()) :: t.free;
+    Condition.signal t.c;
+    Mutex.unlock t.m
+  end
+
+let discard t rdb =
+  close_quietly rdb;
+  Mutex.lock t.m;
+  t.opened <- t.opened - 1;
+  Condition.signal t.c;
+  Mutex.unlock t.m
+
+let network_error = function
+  | Error ((Enohost | Erefused | Esend | Erecv), _, _) -> true
+  | _ -> false
+
+let with_rdb t f =
+  let rdb = checkout t in
+  let r =
+    try f rdb
+    with e -> if network_error e then discard t rdb else checkin t rdb; raise e in
+  checkin t rdb;
+  r
+
+let thread_connection t id =
+  Mutex.lock t.m;
+  let rdb = try Some (Hashtbl.find t.threads id) with Not_found -> None in
+  Mutex.unlock t.m;
+  rdb
+
+let thread_rdb t =
+  let id = Thread.id (Thread.self ()) in
+  let rdb = thread_connection t id in
+  match rdb with
+    | Some rdb -> rdb
+    | None ->
+        let rdb = checkout t in
+        Mutex.lock t.m;
+        Hashtbl.replace t.threads id rdb;
+        Mutex.unlock t.m;
+        rdb
+
+let release_thread t =
+  let id = Thread.id (Thread.self ()) in
+  Mutex.lock t.m;
+  let rdb = try Some (Hashtbl.find t.threads id) with Not_found -> None in
+  Hashtbl.remove t.threads id;
+  Mutex.unlock t.m;
+  match rdb with
+    | Some rdb -> checkin t rdb
+    | None -> ()
+
+let with_thread_rdb t f =
+  let id = Thread.id (Thread.self ()) in
+  (* nested in another with_thread_rdb, the outer one releases it *)
+  let held = thread_connection t id <> None in
+  let rdb = thread_rdb t in
+  let r =
+    try f rdb
+    with e ->
+      if network_error e
+      then begin
+        Mutex.lock t.m;
+        Hashtbl.remove t.threads id;
+        Mutex.unlock t.m;
+        discard t rdb
+      end
+      else if not held then release_thread t;
+      raise e in
+  if not held then release_thread t;
+  r
+
+let locked t f =
+  Mutex.lock t.m;
+  let r = f () in
+  Mutex.unlock t.m;
+  r
+
+let opened t = locked t (fun () -> t.opened)
+let wait_time t = locked t (fun () -> t.wait_time)
+let waits t = locked t (fun () -> t.waits)
@@ -0,0 +1,44 @@
+(*
+  a pool of up to size connections to one ttserver, opened as needed
+  and shared between threads. connections are opened with Trecon, and
+  one that fails with a network error is closed and later replaced.
+  a connection idle for check_idle seconds (default 30) is checked
+  with a stat call before it is handed out again, and replaced if that
+  fails.
+*)
+
+open Tokyo_tyrant
+
+type t
+
+val create : ?size:int -> ?timeout:float -> ?check_idle:float -> string -> int -> t
+
+(* closes idle connections now and checked-out ones when they come back *)
+val close : t -> unit
+
+(* runs f with a connection of its own, waiting for one if all size are in use *)
+val with_rdb : t -> (RDB.t -> 'a) -> 'a
+
+val checkout : t -> RDB.t
+val checkin : t -> RDB.t -> unit
+
+(*
+  the calling thread's connection, checked out on first use. it stays
+  out until release_thread, so a thread that exits without calling it
+  keeps its connection from the pool: prefer with_thread_rdb.
+*)
+val thread_rdb : t -> RDB.t
+val release_thread : t -> unit
+
+(*
+  runs f with the calling thread's connection, releasing it afterwards
+  even if f raises; one that fails with a network error is closed
+  instead, like with with_rdb.
+*)
+val with_thread_rdb : t -> (RDB.t -> 'a) -> 'a
+
+val opened : t -> int
+
+(* total seconds threads have spent waiting for a free connection, and how many times *)
+val wait_time : t -> float
+val waits : t -> int
@@ -0,0 +1,345 @@
+open Tokyo_common
+open Tokyo_tyrant
+
+type server = {
+  host : string;
+  port : int;
+  rdb : RDB.t;
+}
+
+type t = {
+  vnodes : int;
+  mutable servers : server array;
+  mutable ring : (int * int) array; (* (point, server index), sorted by point *)
+  mutable iter : int;
+  mutable timeout : float option;
+  mutable topts : topt list option;
+}
+
+module type Sig =
+sig
+  type cstr_t
+  type tclist_t
+  type tcmap_t
+
+  val new_ : ?vnodes:int -> unit -> t
+
+  val adddouble : t -> cstr_t -> float -> float
+  val addint : t -> cstr_t -> int -> int
+  val close : t -> unit
+  val copy : t -> string -> unit
+  val ext : t -> ?xopts:xopt list -> string -> cstr_t -> cstr_t -> cstr_t
+  val fold : t -> ?chunk:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
+  val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
+  val get : t -> cstr_t -> cstr_t
+  val get_batch : t -> ?chunk_size:int -> cstr_t list -> tcmap_t * (int * int * exn) list
+  val get_into : t -> cstr_t -> Cstr.buf -> int
+  val mget : t -> cstr_t list -> tcmap_t
+  val iter : t -> ?chunk:int -> (cstr_t -> cstr_t -> unit) -> unit
+  val iterinit : t -> unit
+  val iternext : t -> cstr_t
+  val misc : t -> ?mopts:mopt list -> string -> tclist_t -> tclist_t
+  val open_ : t -> string -> int -> unit
+  val optimize : t -> ?params:string -> unit -> unit
+  val out : t -> cstr_t -> unit
+  val out_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> cstr_t list -> (int * int * exn) list
+  val put : t -> cstr_t -> cstr_t -> unit
+  val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
+  val put_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> (cstr_t * cstr_t) list -> (int * int * exn) list
+  val putcat : t -> cstr_t -> cstr_t -> unit
+  val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
+  val putkeep : t -> cstr_t -> cstr_t -> unit
+  val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
+  val putnr : t -> cstr_t -> cstr_t -> unit
+  val putshl : t -> ?width:int -> cstr_t -> cstr_t -> unit
+  val rnum : t -> int64
+  val server : t -> cstr_t -> RDB.t
+  val servers : t -> (string * int * RDB.t) array
+  val size : t -> int64
+  val stat : t -> string
+  val sync : t -> unit
+  val tune : t -> ?timeout:float -> ?topts:topt list -> unit -> unit
+  val vanish : t -> unit
+  val vsiz : t -> cstr_t -> int
+end
+
+let build_ring vnodes servers =
+  let points = ref [] in
+  Array.iteri
+    (fun i s ->
+       for v = 0 to vnodes - 1 do
+         let name = Printf.sprintf "%s:%d-%d" s.host s.port v in
+         points := (Cstr.hash (Cstr.of_string name), i) :: !points
+       done)
+    servers;
+  let ring = Array.of_list !points in
+  Array.sort compare ring;
+  ring
+
+(* index of the first point at or after h, wrapping to 0 *)
+let lookup ring h =
+  let rec search lo hi =
+    if lo >= hi then lo
+    else
+      let mid = (lo + hi) / 2 in
+      if fst ring.(mid) < h then search (mid + 1) hi else search lo mid in
+  let i = search 0 (Array.length ring) in
+  snd ring.(if i = Array.length ring then 0 else i)
+
+(* f on every server, one thread each; raises the first failure once all are done *)
+let each t f =
+  match t.servers with
+    | [| s |] -> [| f 0 s |]
+    | servers ->
+        let ths = Array.mapi (fun i s -> Tokyo_threads.spawn (fun () -> f i s)) servers in
+        Array.of_list (Tokyo_threads.join_all (Array.to_list ths))
+
+let each_unit t f = ignore (each t f)
+let sum t f = Array.fold_left Int64.add 0L (each t (fun _ s -> f s.rdb))
+
+let owner t func key =
+  if Array.length t.servers = 0 then raise (Error (Einvalid, func, "invalid operation"));
+  lookup t.ring (Cstr.hash (Cstr.of_string key))
+
+(* items grouped by the server owning their key, in order, each with its index in items *)
+let scatter t func key_of items =
+  let groups = Array.make (Array.length t.servers) [] in
+  ignore
+    (List.fold_left
+       (fun i x -> let s = owner t func (key_of x) in groups.(s) <- (i, x) :: groups.(s); i + 1)
+       0 items);
+  Array.map List.rev groups
+
+(* f on each server's group, skipping servers that own none of the items *)
+let gather t groups none f =
+  each t (fun i s -> match groups.(i) with [] -> none | group -> f s.rdb group)
+
+(*
+  keys without repeats, in order of first appearance, and for each
+  the positions in keys where it appears.
+*)
+let dedupe keys =
+  let pos = Hashtbl.create 17 in
+  let rec loop uniq i = function
+    | [] -> List.rev uniq
+    | k :: ks ->
+        match (try Some (Hashtbl.find pos k) with Not_found -> None) with
+          | Some l -> l := i :: !l; loop uniq (i + 1) ks
+          | None -> Hashtbl.add pos k (ref [i]); loop (k :: uniq) (i + 1) ks in
+  let uniq = loop [] 0 keys in
+  (uniq, Array.of_list (List.map (fun k -> List.rev !(Hashtbl.find pos k)) uniq))
+
+(* pairs of keys and values found, in the order of keys, which must not repeat *)
+let found_in keys results =
+  let found = Hashtbl.create 17 in
+  Array.iter (List.iter (fun (k, v) -> Hashtbl.replace found k v)) results;
+  List.fold_right (fun k l -> try (k, Hashtbl.find found k) :: l with Not_found -> l) keys []
+
+(*
+  a group's batch failures in terms of the whole list: a group's
+  items aren't contiguous there, so each item of a failed chunk is
+  reported on its own.
+*)
+let spread group fails =
+  let idx = Array.of_list (List.map fst group) in
+  let rec items e first n = if n = 0 then [] else (idx.(first), 1, e) :: items e (first + 1) (n - 1) in
+  List.concat (List.map (fun (first, n, e) -> items e first n) fails)
+
+let sort_fails fails = List.sort (fun (i, _, _) (j, _, _) -> compare i j) fails
+
+let rec pairs = function
+  | k :: v :: l -> (k, v) :: pairs l
+  | _ -> []
+
+module Fun (Cs : Cstr_t) (Tcl : Tclist_t) (Tcm : Tcmap_t) =
+struct
+  type cstr_t = Cs.t
+  type tclist_t = Tcl.t
+  type tcmap_t = Tcm.t
+
+  module R = RDB.Fun (Cs) (Tcl) (Tcm)
+
+  let new_ ?(vnodes = 160) () =
+    if vnodes <= 0 then invalid_arg "new_";
+    {
+      vnodes = vnodes;
+      servers = [||];
+      ring = [||];
+      iter = 0;
+      timeout = None;
+      topts = None;
+    }
+
+  let index t func key =
+    if Array.length t.servers = 0 then raise (Error (Einvalid, func, "invalid operation"));
+    lookup t.ring (Cstr.hash (Cs.to_cstr key))
+
+  let copy_key k = Cstr.copy (Cs.to_cstr k)
+
+  let route t func key = t.servers.(index t func key).rdb
+
+  let server t key = route t "server" key
+  let servers t = Array.map (fun s -> (s.host, s.port, s.rdb)) t.servers
+
+  let of_list l =
+    let tclist = Tclist_list.to_tclist l in
+    let r = Tcl.of_tclist tclist in
+    if Tcl.del then Tclist.del tclist;
+    r
+
+  let adddouble t key num = R.adddouble (route t "adddouble" key) key num
+  let addint t key num = R.addint (route t "addint" key) key num
+
+  let close t =
+    each_unit t (fun _ s -> RDB.close s.rdb);
+    t.servers <- [||];
+    t.ring <- [||]
+
+  let copy t path = each_unit t (fun _ s -> RDB.copy s.rdb path)
+  let ext t ?xopts name key value = R.ext (route t "ext" key) ?xopts name key value
+
+  let fold t ?chunk f a = Array.fold_left (fun a s -> R.fold s.rdb ?chunk f a) a t.servers
+
+  let fwmkeys t ?max prefix =
+    let p = copy_key prefix in
+    let keys = List.concat (Array.to_list (each t (fun _ s -> RDB.fwmkeys s.rdb ?max p))) in
+    let keys =
+      match max with
+        | Some m when m >= 0 ->
+            let rec take n = function
+              | k :: ks when n > 0 -> k :: take (n - 1) ks
+              | _ -> [] in
+            take m keys
+        | _ -> keys in
+    of_list keys
+
+  let get t key = R.get (route t "get" key) key
+  let get_into t key buf = R.get_into (route t "get_into" key) key buf
+
+  let to_tcmap pairs =
+    let tcmap = Tcmap_list.to_tcmap pairs in
+    let r = Tcm.of_tcmap tcmap in
+    if Tcm.del then Tcmap.del tcmap;
+    r
+
+  (* a repeated key is fetched once; if that fails, each of its positions is reported *)
+  let get_batch t ?chunk_size keys =
+    let (keys, positions) = dedupe (List.map copy_key keys) in
+    let results =
+      gather t (scatter t "get_batch" (fun k -> k) keys) ([], [])
+        (fun rdb group ->
+           let (pairs, fails) = RDB.get_batch rdb ?chunk_size (List.map snd group) in
+           (pairs, spread group fails)) in
+    let fails =
+      List.concat
+        (List.map
+           (fun (i, _, e) -> List.map (fun p -> (p, 1, e)) positions.(i))
+           (List.concat (Array.to_list (Array.map snd results)))) in
+    (to_tcmap (found_in keys (Array.map fst results)), sort_fails fails)
+
+  let mget t keys =
+    let (keys, _) = dedupe (List.map copy_key keys) in
+    let pairs =
+      if Array.length t.servers = 0 then []
+      else
+        found_in keys
+          (gather t (scatter t "mget" (fun k -> k) keys) []
+             (fun rdb group -> RDB.mget rdb (List.map snd group))) in
+    to_tcmap pairs
+
+  let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
+
+  let iterinit t =
+    each_unit t (fun _ s -> RDB.iterinit s.rdb);
+    t.iter <- 0
+
+  let iternext t =
+    let rec loop () =
+      if t.iter >= Array.length t.servers
+      then raise (Error (Enorec, "iternext", "no record found"))
+      else
+        try R.iternext t.servers.(t.iter).rdb
+        with Error (Enorec, _, _) -> t.iter <- t.iter + 1; loop () in
+    loop ()
+
+  (*
+    key-bearing commands go to the servers owning their keys, split
+    per owner for the list commands; the rest run on every server.
+  *)
+  let misc t ?mopts name args =
+    let args =
+      let tclist = Tcl.to_tclist args in
+      let l = Tclist_list.of_tclist tclist in
+      if Tcl.del then Tclist.del tclist;
+      l in
+    let on_owners key_of items args_of =
+      List.concat
+        (Array.to_list
+           (gather t (scatter t "misc" key_of items) []
+              (fun rdb group -> RDB.misc rdb ?mopts name (args_of (List.map snd group))))) in
+    let r =
+      match name, args with
+        | ("put" | "putkeep" | "putcat" | "putdup" | "putdupback" | "out" | "get"), key :: _ ->
+            RDB.misc t.servers.(owner t "misc" key).rdb ?mopts name args
+        | "putlist", _ ->
+            on_owners fst (pairs args) (fun ps -> List.concat (List.map (fun (k, v) -> [ k; v ]) ps))
+        | ("outlist" | "getlist"), _ ->
+            on_owners (fun k -> k) args (fun ks -> ks)
+        | _ ->
+            List.concat (Array.to_list (each t (fun _ s -> RDB.misc s.rdb ?mopts name args))) in
+    of_list r
+
+  let open_ t host port =
+    let rdb = RDB.new_ () in
+    RDB.tune rdb ?timeout:t.timeout ?topts:t.topts ();
+    RDB.open_ rdb host port;
+    let servers = Array.append t.servers [| { host = host; port = port; rdb = rdb } |] in
+    t.servers <- servers;
+    t.ring <- build_ring t.vnodes servers
+
+  let optimize t ?params () = each_unit t (fun _ s -> RDB.optimize s.rdb ?params ())
+  let out t key = R.out (route t "out" key) key
+
+  let out_batch t ?mopts ?chunk_size keys =
+    let keys = List.map copy_key keys in
+    let results =
+      gather t (scatter t "out_batch" (fun k -> k) keys) []
+        (fun rdb group -> spread group (RDB.out_batch rdb ?mopts ?chunk_size (List.map snd group))) in
+    sort_fails (List.concat (Array.to_list results))
+
+  let put t key value = R.put (route t "put" key) key value
+  let put_ba t key buf off len = R.put_ba (route t "put_ba" key) key buf off len
+
+  let put_batch t ?mopts ?chunk_size pairs =
+    let pairs = List.map (fun (k, v) -> (copy_key k, copy_key v)) pairs in
+    let results =
+      gather t (scatter t "put_batch" fst pairs) []
+        (fun rdb group -> spread group (RDB.put_batch rdb ?mopts ?chunk_size (List.map snd group))) in
+    sort_fails (List.concat (Array.to_list results))
+
+  let putcat t key value = R.putcat (route t "putcat" key) key value
+  let putcat_ba t key buf off len = R.putcat_ba (route t "putcat_ba" key) key buf off len
+  let putkeep t key value = R.putkeep (route t "putkeep" key) key value
+  let putkeep_ba t key buf off len = R.putkeep_ba (route t "putkeep_ba" key) key buf off len
+  let putnr t key value = R.putnr (route t "putnr" key) key value
+  let putshl t ?width key value = R.putshl (route t "putshl" key) ?width key value
+  let rnum t = sum t RDB.rnum
+  let size t = sum t RDB.size
+
+  let stat t =
+    String.concat ""
+      (Array.to_list
+         (each t (fun _ s -> Printf.sprintf "server\t%s:%d\n%s" s.host s.port (RDB.stat s.rdb))))
+
+  let sync t = each_unit t (fun _ s -> RDB.sync s.rdb)
+
+  let tune t ?timeout ?topts () =
+    if timeout <> None then t.timeout <- timeout;
+    if topts <> None then t.topts <- topts;
+    Array.iter (fun s -> RDB.tune s.rdb ?timeout ?topts ()) t.servers
+
+  let vanish t = each_unit t (fun _ s -> RDB.vanish s.rdb)
+  let vsiz t key = R.vsiz (route t "vsiz" key) key
+end
+
+include Fun (Cstr_string) (Tclist_list) (Tcmap_list)
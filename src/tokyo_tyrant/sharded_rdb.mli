@@ -0,0 +1,74 @@
+(*
+  one logical remote database spread over several ttservers. keys are
+  placed on a consistent-hash ring with vnodes points per server, so
+  adding a server moves only about 1/n of the keys. calls that touch
+  every server run on one thread per server.
+*)
+
+open Tokyo_common
+open Tokyo_tyrant
+
+type t
+
+module type Sig =
+sig
+  type cstr_t
+  type tclist_t
+  type tcmap_t
+
+  val new_ : ?vnodes:int -> unit -> t
+
+  val adddouble : t -> cstr_t -> float -> float
+  val addint : t -> cstr_t -> int -> int
+  val close : t -> unit
+  val copy : t -> string -> unit
+  val ext : t -> ?xopts:xopt list -> string -> cstr_t -> cstr_t -> cstr_t
+  val fold : t -> ?chunk:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
+  val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
+  val get : t -> cstr_t -> cstr_t
+  val get_batch : t -> ?chunk_size:int -> cstr_t list -> tcmap_t * (int * int * exn) list
+  val get_into : t -> cstr_t -> Cstr.buf -> int
+  val mget : t -> cstr_t list -> tcmap_t
+  val iter : t -> ?chunk:int -> (cstr_t -> cstr_t -> unit) -> unit
+  val iterinit : t -> unit
+  val iternext : t -> cstr_t
+  val misc : t -> ?mopts:mopt list -> string -> tclist_t -> tclist_t
+  val open_ : t -> string -> int -> unit
+  val optimize : t -> ?params:string -> unit -> unit
+  val out : t -> cstr_t -> unit
+  val out_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> cstr_t list -> (int * int * exn) list
+  val put : t -> cstr_t -> cstr_t -> unit
+  val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
+  val put_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> (cstr_t * cstr_t) list -> (int * int * exn) list
+  val putcat : t -> cstr_t -> cstr_t -> unit
+  val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
+  val putkeep : t -> cstr_t -> cstr_t -> unit
+  val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
+  val putnr : t -> cstr_t -> cstr_t -> unit
+  val putshl : t -> ?width:int -> cstr_t -> cstr_t -> unit
+  val rnum : t -> int64
+  val server : t -> cstr_t -> RDB.t
+  val servers : t -> (string * int * RDB.t) array
+  val size : t -> int64
+  val stat : t -> string
+  val sync : t -> unit
+  val tune : t -> ?timeout:float -> ?topts:topt list -> unit -> unit
+  val vanish : t -> unit
+  val vsiz : t -> cstr_t -> int
+end
+
+(*
+  open_ adds a server to the ring; call it once per server. misc
+  sends put, putkeep, putcat, putdup, putdupback, out and get to the
+  owner of their first argument, splits putlist, outlist and getlist
+  by owner, and runs anything else on every server, concatenating the
+  results. fold, iter and iternext walk the servers in the order they
+  were added. ext runs on the server owning its key, so a script
+  touching other keys sees only that server. the _batch calls report
+  each item of a failed chunk on its own, as (index, 1, exception).
+  mget and get_batch fetch a repeated key once.
+*)
+include Sig with type cstr_t = string and type tclist_t = string list and type tcmap_t = (string * string) list
+
+module Fun (Cs : Cstr_t) (Tcl : Tclist_t) (Tcm : Tcmap_t) :
+  Sig with type cstr_t = Cs.t and type tclist_t = Tcl.t and type tcmap_t = Tcm.t
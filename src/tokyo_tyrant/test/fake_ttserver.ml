@@ -0,0 +1,162 @@
+(*
+  in-process stand-in for ttserver: speaks enough of the binary
+  protocol to exercise Tokyo_tyrant_lwt (put, out, get, vsiz, vanish,
+  rnum, and misc iterinit, iternext, putlist, outlist and getlist)
+  over a Hashtbl, on a loopback port chosen by the kernel.
+*)
+
+open Lwt
+
+(* what the nth misc "iternext" (counting from 1) does instead of answering *)
+type fault =
+  | Code of int (* answers with this status byte *)
+  | Drop        (* closes the connection *)
+
+type t = {
+  fd : Lwt_unix.file_descr;
+  port : int;
+  store : (string, string) Hashtbl.t;
+  mutable iter : string list;
+  mutable iternexts : int;
+  mutable fault : (int * fault) option;
+}
+
+exception Dropped
+
+let read_int32 ic = Lwt_io.BE.read_int32 ic >>= fun n -> return (Int32.to_int n)
+
+let read_string ic len =
+  let s = String.create len in
+  Lwt_io.read_into_exactly ic s 0 len >>= fun () ->
+  return s
+
+let read_sized ic = read_int32 ic >>= read_string ic
+
+let write_code oc code = Lwt_io.write_char oc (Char.chr code)
+let write_int32 oc n = Lwt_io.BE.write_int32 oc (Int32.of_int n)
+let write_sized oc s = write_int32 oc (String.length s) >>= fun () -> Lwt_io.write oc s
+
+let find t k = try Some (Hashtbl.find t.store k) with Not_found -> None
+
+(* None is a failed misc, answered with status 1 like ttserver *)
+let misc t name args =
+  match name with
+    | "iterinit" ->
+        t.iter <- Hashtbl.fold (fun k _ l -> k :: l) t.store [];
+        Some []
+    | "iternext" ->
+        let rec next () =
+          match t.iter with
+            | [] -> None
+            | k :: l ->
+                t.iter <- l;
+                match find t k with
+                  | Some v -> Some [k; v]
+                  | None -> next () in
+        next ()
+    | "putlist" ->
+        let rec put = function
+          | k :: v :: l -> Hashtbl.replace t.store k v; put l
+          | _ -> () in
+        put args;
+        Some []
+    | "outlist" ->
+        List.iter (Hashtbl.remove t.store) args;
+        Some []
+    | "getlist" ->
+        Some (List.fold_right (fun k l -> match find t k with Some v -> k :: v :: l | None -> l) args [])
+    | _ -> None
+
+let reply_misc oc = function
+  | Some l ->
+      write_code oc 0 >>= fun () ->
+      write_int32 oc (List.length l) >>= fun () ->
+      Lwt_list.iter_s (write_sized oc) l
+  | None -> write_code oc 1
+
+let handle t ic oc = function
+  | 0x10 ->
+      read_int32 ic >>= fun ksiz ->
+      read_int32 ic >>= fun vsiz ->
+      read_string ic ksiz >>= fun k ->
+      read_string ic vsiz >>= fun v ->
+      Hashtbl.replace t.store k v;
+      write_code oc 0
+  | 0x20 ->
+      read_sized ic >>= fun k ->
+      if Hashtbl.mem t.store k then (Hashtbl.remove t.store k; write_code oc 0)
+      else write_code oc 1
+  | 0x30 ->
+      read_sized ic >>= fun k ->
+      begin match find t k with
+        | Some v -> write_code oc 0 >>= fun () -> write_sized oc v
+        | None -> write_code oc 1
+      end
+  | 0x38 ->
+      read_sized ic >>= fun k ->
+      begin match find t k with
+        | Some v -> write_code oc 0 >>= fun () -> write_int32 oc (String.length v)
+        | None -> write_code oc 1
+      end
+  | 0x72 ->
+      Hashtbl.clear t.store;
+      write_code oc 0
+  | 0x80 ->
+      write_code oc 0 >>= fun () ->
+      Lwt_io.BE.write_int64 oc (Int64.of_int (Hashtbl.length t.store))
+  | 0x90 ->
+      read_int32 ic >>= fun nsiz ->
+      read_int32 ic >>= fun _ ->
+      read_int32 ic >>= fun n ->
+      read_string ic nsiz >>= fun name ->
+      let rec args acc n =
+        if n = 0 then return (List.rev acc)
+        else read_sized ic >>= fun a -> args (a :: acc) (n - 1) in
+      args [] n >>= fun args ->
+      if name <> "iternext" then reply_misc oc (misc t name args)
+      else begin
+        t.iternexts <- t.iternexts + 1;
+        match t.fault with
+          | Some (n, Code code) when n = t.iternexts -> write_code oc code
+          | Some (n, Drop) when n = t.iternexts -> fail Dropped
+          | _ -> reply_misc oc (misc t name args)
+      end
+  | cmd -> failwith (Printf.sprintf "fake_ttserver: command 0x%02x" cmd)
+
+let rec serve t ic oc =
+  Lwt_io.read_char ic >>= fun magic ->
+  if magic <> '\xc8' then failwith "fake_ttserver: bad magic";
+  Lwt_io.read_char ic >>= fun cmd ->
+  handle t ic oc (Char.code cmd) >>= fun () ->
+  Lwt_io.flush oc >>= fun () ->
+  serve t ic oc
+
+let start () =
+  let fd = Lwt_unix.socket Unix.PF_INET Unix.SOCK_STREAM 0 in
+  Lwt_unix.setsockopt fd Unix.SO_REUSEADDR true;
+  Lwt_unix.bind fd (Unix.ADDR_INET (Unix.inet_addr_loopback, 0));
+  Lwt_unix.listen fd 16;
+  let port =
+    match Unix.getsockname (Lwt_unix.unix_file_descr fd) with
+      | Unix.ADDR_INET (_, port) -> port
+      | Unix.ADDR_UNIX _ -> assert false in
+  let t = { fd = fd; port = port; store = Hashtbl.create 17; iter = []; iternexts = 0; fault = None } in
+  let rec accept () =
+    Lwt_unix.accept fd >>= fun (cfd, _) ->
+    (* the output channel owns the fd *)
+    let ic = Lwt_io.of_fd ~mode:Lwt_io.input ~close:return cfd in
+    let oc = Lwt_io.of_fd ~mode:Lwt_io.output cfd in
+    ignore_result
+      (catch (fun () -> serve t ic oc) (fun _ -> return ()) >>= fun () ->
+       catch (fun () -> Lwt_io.close oc) (fun _ -> return ()));
+    accept () in
+  ignore_result (catch accept (fun _ -> return ()));
+  t
+
+let port t = t.port
+
+let fault t f =
+  t.iternexts <- 0;
+  t.fault <- f
+
+let stop t = Lwt_unix.close t.fd
@@ -0,0 +1,87 @@
+(*
+  exercises Tokyo_tyrant_lwt.RDB against Fake_ttserver: the basic
+  calls, fold (including failures partway through the iteration) and
+  the _batch calls.
+*)
+
+open Lwt
+open Tokyo_tyrant
+
+module RDB = Tokyo_tyrant_lwt.RDB
+
+let records = Array.to_list (Array.init 100 (fun i -> (Printf.sprintf "key%03d" i, string_of_int i)))
+
+(* fails unless p raises Error (e, func, _) *)
+let raises e func p =
+  catch
+    (fun () -> p >>= fun _ -> return false)
+    (function
+       | Error (e', func', _) when e' = e && func' = func -> return true
+       | _ -> return false) >>= fun ok ->
+  assert ok;
+  return ()
+
+let with_rdb srv f =
+  let rdb = RDB.new_ () in
+  RDB.open_ rdb "127.0.0.1" (Fake_ttserver.port srv) >>= fun () ->
+  finalize (fun () -> f rdb) (fun () -> RDB.close rdb)
+
+let test_basic srv =
+  with_rdb srv (fun rdb ->
+    RDB.vanish rdb >>= fun () ->
+    RDB.put rdb "a" "alpha" >>= fun () ->
+    RDB.get rdb "a" >>= fun v ->
+    assert (v = "alpha");
+    RDB.vsiz rdb "a" >>= fun n ->
+    assert (n = 5);
+    RDB.rnum rdb >>= fun n ->
+    assert (n = 1L);
+    RDB.out rdb "a" >>= fun () ->
+    raises Enorec "get" (RDB.get rdb "a") >>= fun () ->
+    raises Enorec "out" (RDB.out rdb "a"))
+
+let test_batch srv =
+  with_rdb srv (fun rdb ->
+    RDB.vanish rdb >>= fun () ->
+    RDB.put_batch rdb ~chunk_size:64 records >>= fun failed ->
+    assert (failed = []);
+    RDB.get_batch rdb ~chunk_size:64 (List.map fst records) >>= fun (pairs, failed) ->
+    assert (failed = []);
+    assert (List.sort compare pairs = records);
+    RDB.out_batch rdb ~chunk_size:64 (List.map fst records) >>= fun failed ->
+    assert (failed = []);
+    RDB.rnum rdb >>= fun n ->
+    assert (n = 0L);
+    return ())
+
+let test_fold srv =
+  with_rdb srv (fun rdb ->
+    RDB.vanish rdb >>= fun () ->
+    Lwt_list.iter_s (fun (k, v) -> RDB.put rdb k v) records >>= fun () ->
+    Lwt_list.iter_s
+      (fun depth ->
+         RDB.fold rdb ~depth (fun k v l -> (k, v) :: l) [] >>= fun l ->
+         assert (List.sort compare l = records);
+         return ())
+      [1; 7; 64; 1000])
+
+(* a failed iternext while records remain must not look like the end *)
+let test_fold_errors srv =
+  let fold_with fault e =
+    Fake_ttserver.fault srv (Some fault);
+    with_rdb srv (fun rdb -> raises e "fold" (RDB.fold rdb (fun _ _ n -> n + 1) 0)) >>= fun () ->
+    Fake_ttserver.fault srv None;
+    return () in
+  fold_with (10, Fake_ttserver.Code 1) Emisc >>= fun () ->
+  fold_with (10, Fake_ttserver.Code 9) Emisc >>= fun () ->
+  fold_with (10, Fake_ttserver.Drop) Erecv
+
+let () =
+  Lwt_main.run begin
+    let srv = Fake_ttserver.start () in
+    test_basic srv >>= fun () ->
+    test_batch srv >>= fun () ->
+    test_fold srv >>= fun () ->
+    test_fold_errors srv >>= fun () ->
+    Fake_ttserver.stop srv
+  end
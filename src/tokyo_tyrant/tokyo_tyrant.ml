@@ -16,6 +16,31 @@ type mopt = Monoulog
 
 type topt = Trecon
 
+type xopt = Xolckrec | Xolckglb
+
+(* f over each item, freeing the rest with del if it raises *)
+let fold_chunk conv del f items a =
+  let len = Array.length items in
+  let rec loop a i =
+    if i = len then a
+    else
+      let a =
+        try f (conv items.(i)) a
+        with e -> for j = i + 1 to len - 1 do del items.(j) done; raise e in
+      loop a (i + 1) in
+  loop a 0
+
+(* (index of first item, items) runs of about size bytes; an item bigger than size gets a run to itself *)
+let batch_chunks size bytes items =
+  let rec loop acc cur cur_bytes i start = function
+    | [] -> List.rev (if cur = [] then acc else (start, List.rev cur) :: acc)
+    | x :: xs ->
+        let b = bytes x in
+        if cur <> [] && cur_bytes + b > size
+        then loop ((start, List.rev cur) :: acc) [x] b (i + 1) i xs
+        else loop acc (x :: cur) (cur_bytes + b) (i + 1) start xs in
+  loop [] [] 0 0 0 items
+
 module RDB =
 struct
   type t
@@ -24,6 +49,7 @@ struct
   sig
     type cstr_t
     type tclist_t
+    type tcmap_t
 
     val new_ : unit -> t
 
@@ -31,18 +57,28 @@ struct
     val addint : t -> cstr_t -> int -> int
     val close : t -> unit
     val copy : t -> string -> unit
+    val ext : t -> ?xopts:xopt list -> string -> cstr_t -> cstr_t -> cstr_t
+    val fold : t -> ?chunk:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val get : t -> cstr_t -> cstr_t
-  (*val mget : t -> ? -> ?*)
+    val get_batch : t -> ?chunk_size:int -> cstr_t list -> tcmap_t * (int * int * exn) list
+    val get_into : t -> cstr_t -> Cstr.buf -> int
+    val mget : t -> cstr_t list -> tcmap_t
+    val iter : t -> ?chunk:int -> (cstr_t -> cstr_t -> unit) -> unit
     val iterinit : t -> unit
     val iternext : t -> cstr_t
     val misc : t -> ?mopts:mopt list -> string -> tclist_t -> tclist_t
     val open_ : t -> string -> int -> unit
     val optimize : t -> ?params:string -> unit -> unit
     val out : t -> cstr_t -> unit
+    val out_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> cstr_t list -> (int * int * exn) list
     val put : t -> cstr_t -> cstr_t -> unit
+    val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
+    val put_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> (cstr_t * cstr_t) list -> (int * int * exn) list
     val putcat : t -> cstr_t -> cstr_t -> unit
+    val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putkeep : t -> cstr_t -> cstr_t -> unit
+    val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putnr : t -> cstr_t -> cstr_t -> unit
     val putshl : t -> ?width:int -> cstr_t -> cstr_t -> unit
     val rnum : t -> int64
@@ -54,10 +90,11 @@ struct
     val vsiz : t -> cstr_t -> int
   end
 
-  module Fun (Cs : Cstr_t) (Tcl : Tclist_t) =
+  module Fun (Cs : Cstr_t) (Tcl : Tclist_t) (Tcm : Tcmap_t) =
   struct
     type cstr_t = Cs.t
     type tclist_t = Tcl.t
+    type tcmap_t = Tcm.t
 
     external new_ : unit -> t = "otoky_rdb_new"
 
@@ -70,6 +107,56 @@ struct
     external close : t -> unit = "otoky_rdb_close"
     external copy : t -> string -> unit = "otoky_rdb_copy"
 
+    external _ext : t -> ?xopts:xopt list -> string -> string -> int -> string -> int -> Cstr.t = "otoky_rdb_ext_bc" "otoky_rdb_ext"
+    let ext t ?xopts name key value =
+      let cstr = _ext t ?xopts name (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value) in
+      let r = Cs.of_cstr cstr in
+      if Cs.del then Cstr.del cstr;
+      r
+
+    external _range_pairs : t -> string -> int -> int -> int -> (Cstr.t * Cstr.t) array = "otoky_rdb_range_pairs"
+
+    let conv_pair (k, v) =
+      let k' = Cs.of_cstr k in
+      if Cs.del then Cstr.del k;
+      let v' = Cs.of_cstr v in
+      if Cs.del then Cstr.del v;
+      (k', v')
+
+    let del_pair (k, v) = Cstr.del k; Cstr.del v
+
+    (* keys may be naked C pointers, so read them only with unsafe_get *)
+    let key_is key (s, len) =
+      if len <> String.length key
+      then false
+      else
+        let rec loop i =
+          if i = len then true
+          else if String.unsafe_get s i <> String.unsafe_get key i then false
+          else loop (i + 1) in
+        loop 0
+
+    (*
+      pages of chunk records through misc "range", resuming at the
+      last key of the page before and skipping the records under it
+      already seen; so B+ tree databases only. a key with many
+      duplicates makes each page re-read them.
+    *)
+    let fold t ?(chunk = 1024) f a =
+      if chunk <= 0 then invalid_arg "fold";
+      let rec loop a bkey skip =
+        let items = _range_pairs t bkey (String.length bkey) skip chunk in
+        let len = Array.length items in
+        if len = 0 then a
+        else
+          let last = Cstr.copy (fst items.(len - 1)) in
+          let rec trailing i = if i >= 0 && key_is last (fst items.(i)) then trailing (i - 1) else len - 1 - i in
+          let seen = trailing (len - 1) in
+          let skip = if seen = len && last = bkey then skip + len else seen in
+          let a = fold_chunk conv_pair del_pair (fun (k, v) a -> f k v a) items a in
+          if len < chunk then a else loop a last skip in
+      loop a "" 0
+
     external _fwmkeys : t -> ?max:int -> string -> int -> Tclist.t = "otoky_rdb_fwmkeys"
     let fwmkeys t ?max prefix =
       let tclist = _fwmkeys t ?max (Cs.string prefix) (Cs.length prefix) in
@@ -84,7 +171,22 @@ struct
       if Cs.del then Cstr.del cstr;
       r
 
-  (*let mget : t -> ? -> ?*)
+    external _get_into : t -> string -> int -> Cstr.buf -> int = "otoky_rdb_get_into"
+    let get_into t key buf = _get_into t (Cs.string key) (Cs.length key) buf
+
+    external _mget : t -> Tcmap.t -> unit = "otoky_rdb_mget"
+    let mget t keys =
+      let tcmap = Tcmap.new_ () in
+      let r =
+        try
+          List.iter (fun key -> Tcmap.put tcmap (Cs.string key) (Cs.length key) "" 0) keys;
+          _mget t tcmap;
+          Tcm.of_tcmap tcmap
+        with e -> Tcmap.del tcmap; raise e in
+      if Tcm.del then Tcmap.del tcmap;
+      r
+
+    let iter t ?chunk f = fold t ?chunk (fun k v () -> f k v) ()
 
     external iterinit : t -> unit = "otoky_rdb_iterinit"
 
@@ -110,6 +212,54 @@ struct
       else
         Tcl.of_tclist (_misc t ?mopts name (Tcl.to_tclist args))
 
+    (*
+      runs misc name once per chunk of about chunk_size bytes of items,
+      carrying on past failures; returns (index of first item, items,
+      exception) for each chunk that failed.
+    *)
+    let misc_batch t ?mopts ?(chunk_size = 1048576) func name push bytes items f =
+      if chunk_size <= 0 then invalid_arg func;
+      let run failed (start, chunk) =
+        let args = Tclist.new_ () in
+        let failed =
+          try
+            List.iter (push args) chunk;
+            let r = _misc t ?mopts name args in
+            begin try f r with e -> Tclist.del r; raise e end;
+            Tclist.del r;
+            failed
+          with e -> (start, List.length chunk, e) :: failed in
+        Tclist.del args;
+        failed in
+      List.rev (List.fold_left run [] (batch_chunks chunk_size bytes items))
+
+    let push_cstr args c = Tclist.push args (Cs.string c) (Cs.length c)
+
+    let get_batch t ?chunk_size keys =
+      let tcmap = Tcmap.new_ () in
+      let add r =
+        let klen = ref 0 and vlen = ref 0 in
+        for i = 0 to Tclist.num r / 2 - 1 do
+          let k = Tclist.val_ r (2 * i) klen in
+          let v = Tclist.val_ r (2 * i + 1) vlen in
+          Tcmap.put tcmap k !klen v !vlen
+        done in
+      let failed =
+        try misc_batch t ?chunk_size "get_batch" "getlist" push_cstr Cs.length keys add
+        with e -> Tcmap.del tcmap; raise e in
+      let r = Tcm.of_tcmap tcmap in
+      if Tcm.del then Tcmap.del tcmap;
+      (r, failed)
+
+    let out_batch t ?mopts ?chunk_size keys =
+      misc_batch t ?mopts ?chunk_size "out_batch" "outlist" push_cstr Cs.length keys ignore
+
+    let put_batch t ?mopts ?chunk_size pairs =
+      misc_batch t ?mopts ?chunk_size "put_batch" "putlist"
+        (fun args (k, v) -> push_cstr args k; push_cstr args v)
+        (fun (k, v) -> Cs.length k + Cs.length v)
+        pairs ignore
+
     external open_ : t -> string -> int -> unit = "otoky_rdb_open"
     external optimize : t -> ?params:string -> unit -> unit = "otoky_rdb_optimize"
 
@@ -119,12 +269,27 @@ struct
     external _put : t -> string -> int -> string -> int -> unit = "otoky_rdb_put"
     let put t key value = _put t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _put_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_rdb_put_ba_bc" "otoky_rdb_put_ba"
+    let put_ba t key buf off len =
+      Cstr.check_buf buf off len "put_ba";
+      _put_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putcat : t -> string -> int -> string -> int -> unit = "otoky_rdb_putcat"
     let putcat t key value = _putcat t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _putcat_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_rdb_putcat_ba_bc" "otoky_rdb_putcat_ba"
+    let putcat_ba t key buf off len =
+      Cstr.check_buf buf off len "putcat_ba";
+      _putcat_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putkeep : t -> string -> int -> string -> int -> unit = "otoky_rdb_putkeep"
     let putkeep t key value = _putkeep t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
+    external _putkeep_ba : t -> string -> int -> Cstr.buf -> int -> int -> unit = "otoky_rdb_putkeep_ba_bc" "otoky_rdb_putkeep_ba"
+    let putkeep_ba t key buf off len =
+      Cstr.check_buf buf off len "putkeep_ba";
+      _putkeep_ba t (Cs.string key) (Cs.length key) buf off len
+
     external _putnr : t -> string -> int -> string -> int -> unit = "otoky_rdb_putnr"
     let putnr t key value = _putnr t (Cs.string key) (Cs.length key) (Cs.string value) (Cs.length value)
 
@@ -142,5 +307,5 @@ struct
     let vsiz t key = _vsiz t (Cs.string key) (Cs.length key)
   end
 
-  include Fun (Cstr_string) (Tclist_list)
+  include Fun (Cstr_string) (Tclist_list) (Tcmap_list)
 end
@@ -16,6 +16,11 @@ type mopt = Monoulog
 
 type topt = Trecon
 
+type xopt = Xolckrec | Xolckglb
+
+(* (index of first item, items) runs of about size bytes, as the _batch calls send them *)
+val batch_chunks : int -> ('a -> int) -> 'a list -> (int * 'a list) list
+
 module RDB :
 sig
   type t
@@ -24,6 +29,7 @@ sig
   sig
     type cstr_t
     type tclist_t
+    type tcmap_t
 
     val new_ : unit -> t
 
@@ -31,18 +37,28 @@ sig
     val addint : t -> cstr_t -> int -> int
     val close : t -> unit
     val copy : t -> string -> unit
+    val ext : t -> ?xopts:xopt list -> string -> cstr_t -> cstr_t -> cstr_t
+    val fold : t -> ?chunk:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a
     val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t
     val get : t -> cstr_t -> cstr_t
-  (*val mget : t -> ? -> ?*)
+    val get_batch : t -> ?chunk_size:int -> cstr_t list -> tcmap_t * (int * int * exn) list
+    val get_into : t -> cstr_t -> Cstr.buf -> int
+    val mget : t -> cstr_t list -> tcmap_t
+    val iter : t -> ?chunk:int -> (cstr_t -> cstr_t -> unit) -> unit
     val iterinit : t -> unit
     val iternext : t -> cstr_t
     val misc : t -> ?mopts:mopt list -> string -> tclist_t -> tclist_t
     val open_ : t -> string -> int -> unit
     val optimize : t -> ?params:string -> unit -> unit
     val out : t -> cstr_t -> unit
+    val out_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> cstr_t list -> (int * int * exn) list
     val put : t -> cstr_t -> cstr_t -> unit
+    val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
+    val put_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> (cstr_t * cstr_t) list -> (int * int * exn) list
     val putcat : t -> cstr_t -> cstr_t -> unit
+    val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putkeep : t -> cstr_t -> cstr_t -> unit
+    val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit
     val putnr : t -> cstr_t -> cstr_t -> unit
     val putshl : t -> ?width:int -> cstr_t -> cstr_t -> unit
     val rnum : t -> int64
@@ -54,7 +70,18 @@ sig
     val vsiz : t -> cstr_t -> int
   end
 
-  include Sig with type cstr_t = string and type tclist_t = string list
+  (*
+    fold and iter page through misc "range", which only a B+ tree
+    database supports; against a hash or other database they raise
+    Error (Emisc, "fold", _).
+
+    get_batch, out_batch and put_batch send items through misc
+    getlist/outlist/putlist in chunks of about chunk_size bytes
+    (default 1MB). a failed chunk doesn't stop the rest; each is
+    reported as (index of its first item, number of items, exception).
+  *)
+  include Sig with type cstr_t = string and type tclist_t = string list and type tcmap_t = (string * string) list
 
-  module Fun (Cs : Cstr_t) (Tcl : Tclist_t) : Sig with type cstr_t = Cs.t and type tclist_t = Tcl.t
+  module Fun (Cs : Cstr_t) (Tcl : Tclist_t) (Tcm : Tcmap_t) :
+    Sig with type cstr_t = Cs.t and type tclist_t = Tcl.t and type tcmap_t = Tcm.t
 end
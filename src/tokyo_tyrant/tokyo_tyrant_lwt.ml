@@ -0,0 +1,507 @@
+open Lwt
+open Tokyo_common
+open Tokyo_tyrant
+
+let errmsg = function
+  | Einvalid -> "invalid operation"
+  | Enohost -> "host not found"
+  | Erefused -> "connection refused"
+  | Esend -> "send error"
+  | Erecv -> "recv error"
+  | Ekeep -> "existing record"
+  | Enorec -> "no record found"
+  | Emisc -> "miscellaneous error"
+
+let error e func = fail (Error (e, func, errmsg e))
+
+let request cmd =
+  let b = Buffer.create 64 in
+  Buffer.add_char b '\xc8';
+  Buffer.add_char b (Char.chr cmd);
+  b
+
+let add_int32 b n =
+  Buffer.add_char b (Char.unsafe_chr ((n lsr 24) land 0xff));
+  Buffer.add_char b (Char.unsafe_chr ((n lsr 16) land 0xff));
+  Buffer.add_char b (Char.unsafe_chr ((n lsr 8) land 0xff));
+  Buffer.add_char b (Char.unsafe_chr (n land 0xff))
+
+let add_int64 b n =
+  for i = 7 downto 0 do
+    Buffer.add_char b (Char.unsafe_chr (Int64.to_int (Int64.logand (Int64.shift_right_logical n (i * 8)) 0xffL)))
+  done
+
+let string_of_buf buf off len =
+  let s = String.create len in
+  for i = 0 to len - 1 do
+    String.unsafe_set s i (Bigarray.Array1.unsafe_get buf (off + i))
+  done;
+  s
+
+let read_code ic = Lwt_io.read_char ic >>= fun c -> return (Char.code c)
+let read_int32 ic = Lwt_io.BE.read_int32 ic >>= fun n -> return (Int32.to_int n)
+
+let read_string ic len =
+  let s = String.create len in
+  Lwt_io.read_into_exactly ic s 0 len >>= fun () ->
+  return s
+
+let read_sized ic = read_int32 ic >>= read_string ic
+
+let read_list ic =
+  read_int32 ic >>= fun n ->
+  let rec loop acc n =
+    if n = 0 then return (List.rev acc)
+    else read_sized ic >>= fun s -> loop (s :: acc) (n - 1) in
+  loop [] n
+
+(* reads the status byte; anything but 0 is reported as e *)
+let expect e func ic k =
+  read_code ic >>= fun code ->
+  if code = 0 then k () else error e func
+
+module RDB =
+struct
+  type conn = {
+    mutable chans : (Lwt_io.input_channel * Lwt_io.output_channel) Lwt.t option;
+    mutable written : unit Lwt.t; (* the last request has been queued for sending *)
+    mutable read : unit Lwt.t;    (* the last response has been read *)
+  }
+
+  type t = {
+    mutable addr : Unix.sockaddr option;
+    mutable conns : conn array;
+    mutable next : int;
+    mutable timeout : float;
+    mutable recon : bool;
+  }
+
+  module type Sig =
+  sig
+    type cstr_t
+    type tclist_t
+
+    val new_ : unit -> t
+
+    val adddouble : t -> cstr_t -> float -> float Lwt.t
+    val addint : t -> cstr_t -> int -> int Lwt.t
+    val close : t -> unit Lwt.t
+    val copy : t -> string -> unit Lwt.t
+    val ext : t -> ?xopts:xopt list -> string -> cstr_t -> cstr_t -> cstr_t Lwt.t
+    val fold : t -> ?depth:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a Lwt.t
+    val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t Lwt.t
+    val get : t -> cstr_t -> cstr_t Lwt.t
+    val get_batch : t -> ?chunk_size:int -> ?window:int -> cstr_t list -> ((cstr_t * cstr_t) list * (int * int * exn) list) Lwt.t
+    val get_into : t -> cstr_t -> Cstr.buf -> int Lwt.t
+    val mget : t -> cstr_t list -> (cstr_t * cstr_t) list Lwt.t
+    val iter : t -> ?depth:int -> (cstr_t -> cstr_t -> unit) -> unit Lwt.t
+    val iterinit : t -> unit Lwt.t
+    val iternext : t -> cstr_t Lwt.t
+    val misc : t -> ?mopts:mopt list -> string -> tclist_t -> tclist_t Lwt.t
+    val open_ : t -> ?conns:int -> string -> int -> unit Lwt.t
+    val optimize : t -> ?params:string -> unit -> unit Lwt.t
+    val out : t -> cstr_t -> unit Lwt.t
+    val out_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> ?window:int -> cstr_t list -> (int * int * exn) list Lwt.t
+    val put : t -> cstr_t -> cstr_t -> unit Lwt.t
+    val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit Lwt.t
+    val put_batch :
+      t -> ?mopts:mopt list -> ?chunk_size:int -> ?window:int ->
+      (cstr_t * cstr_t) list -> (int * int * exn) list Lwt.t
+    val putcat : t -> cstr_t -> cstr_t -> unit Lwt.t
+    val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit Lwt.t
+    val putkeep : t -> cstr_t -> cstr_t -> unit Lwt.t
+    val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit Lwt.t
+    val putnr : t -> cstr_t -> cstr_t -> unit Lwt.t
+    val putshl : t -> ?width:int -> cstr_t -> cstr_t -> unit Lwt.t
+    val rnum : t -> int64 Lwt.t
+    val size : t -> int64 Lwt.t
+    val stat : t -> string Lwt.t
+    val sync : t -> unit Lwt.t
+    val tune : t -> ?timeout:float -> ?topts:topt list -> unit -> unit
+    val vanish : t -> unit Lwt.t
+    val vsiz : t -> cstr_t -> int Lwt.t
+  end
+
+  type cstr_t = string
+  type tclist_t = string list
+
+  let new_ () = {
+    addr = None;
+    conns = [||];
+    next = 0;
+    timeout = 0.;
+    recon = false;
+  }
+
+  let connect addr =
+    let fd = Lwt_unix.socket (Unix.domain_of_sockaddr addr) Unix.SOCK_STREAM 0 in
+    catch
+      (fun () ->
+         Lwt_unix.connect fd addr >>= fun () ->
+         begin match addr with
+           | Unix.ADDR_INET _ -> Lwt_unix.setsockopt fd Unix.TCP_NODELAY true
+           | Unix.ADDR_UNIX _ -> ()
+         end;
+         (* the output channel owns the fd *)
+         let ic = Lwt_io.of_fd ~mode:Lwt_io.input ~close:return fd in
+         let oc = Lwt_io.of_fd ~mode:Lwt_io.output fd in
+         return (ic, oc))
+      (fun _ ->
+         ignore_result (catch (fun () -> Lwt_unix.close fd) (fun _ -> return ()));
+         error Erefused "open")
+
+  let current c p =
+    match c.chans with
+      | Some p' -> p' == p
+      | None -> false
+
+  (* drops a connection whose stream can no longer be trusted *)
+  let break c p =
+    if current c p then begin
+      c.chans <- None;
+      ignore_result
+        (catch
+           (fun () -> p >>= fun (_, oc) -> Lwt_io.close oc)
+           (fun _ -> return ()))
+    end
+
+  let chans t c =
+    match c.chans, t.addr with
+      | Some p, _ -> Some p
+      | None, Some addr when t.recon ->
+          let p = connect addr in
+          c.chans <- Some p;
+          ignore_result (catch (fun () -> p >>= fun _ -> return ()) (fun _ -> break c p; return ()));
+          Some p
+      | None, _ -> None
+
+  (*
+    sends req on a connection and reads its response with read once
+    every earlier response on that connection has been read. if read
+    raises Error the response was consumed and the connection is still
+    good; any other failure breaks it.
+  *)
+  let call t ?conn func req read =
+    let n = Array.length t.conns in
+    if n = 0 then error Einvalid func
+    else
+      let c =
+        match conn with
+          | Some i -> t.conns.(i)
+          | None -> let c = t.conns.(t.next mod n) in t.next <- (t.next + 1) mod n; c in
+      match chans t c with
+        | None -> error Einvalid func
+        | Some p ->
+            let prev_written = c.written and prev_read = c.read in
+            let written =
+              prev_written >>= fun () ->
+              catch
+                (fun () -> p >>= fun (_, oc) -> Lwt_io.write oc (Buffer.contents req))
+                (fun _ -> break c p; error Esend func) in
+            c.written <- catch (fun () -> written) (fun _ -> return ());
+            let r =
+              written >>= fun () ->
+              prev_read >>= fun () ->
+              if not (current c p) then error Erecv func
+              else
+                catch
+                  (fun () -> p >>= fun (ic, _) -> read ic)
+                  (function
+                     | Error _ as e -> fail e
+                     | _ -> break c p; error Erecv func) in
+            let r =
+              if t.timeout > 0.
+              then
+                catch
+                  (fun () -> Lwt_unix.with_timeout t.timeout (fun () -> r))
+                  (function
+                     | Lwt_unix.Timeout -> break c p; error Erecv func
+                     | e -> fail e)
+              else r in
+            let read, wake = Lwt.wait () in
+            c.read <- read;
+            Lwt.on_termination r (fun () -> Lwt.wakeup wake ());
+            r
+
+  (* requests with no response, like putnr *)
+  let send t func req =
+    call t func req (fun _ -> return ())
+
+  let misc_req mopts name args =
+    let req = request 0x90 in
+    add_int32 req (String.length name);
+    add_int32 req (if List.mem Monoulog mopts then 1 else 0);
+    add_int32 req (List.length args);
+    Buffer.add_string req name;
+    List.iter (fun a -> add_int32 req (String.length a); Buffer.add_string req a) args;
+    req
+
+  let unit_call t func req = call t func req (fun ic -> expect Emisc func ic return)
+
+  let adddouble t key num =
+    let integ = floor num in
+    let req = request 0x61 in
+    add_int32 req (String.length key);
+    add_int64 req (Int64.of_float integ);
+    add_int64 req (Int64.of_float ((num -. integ) *. 1e12));
+    Buffer.add_string req key;
+    call t "adddouble" req (fun ic ->
+      expect Ekeep "adddouble" ic (fun () ->
+        Lwt_io.BE.read_int64 ic >>= fun integ ->
+        Lwt_io.BE.read_int64 ic >>= fun fract ->
+        return (Int64.to_float integ +. Int64.to_float fract /. 1e12)))
+
+  let addint t key num =
+    let req = request 0x60 in
+    add_int32 req (String.length key);
+    add_int32 req num;
+    Buffer.add_string req key;
+    call t "addint" req (fun ic -> expect Ekeep "addint" ic (fun () -> Lwt_io.BE.read_int32 ic >>= fun n -> return (Int32.to_int n)))
+
+  let close t =
+    let conns = t.conns in
+    t.conns <- [||];
+    t.addr <- None;
+    Lwt_list.iter_p
+      (fun c ->
+         c.read >>= fun () ->
+         match c.chans with
+           | None -> return ()
+           | Some p ->
+               c.chans <- None;
+               catch (fun () -> p >>= fun (_, oc) -> Lwt_io.close oc) (fun _ -> return ()))
+      (Array.to_list conns)
+
+  let copy t path =
+    let req = request 0x73 in
+    add_int32 req (String.length path);
+    Buffer.add_string req path;
+    unit_call t "copy" req
+
+  let ext t ?(xopts = []) name key value =
+    let req = request 0x68 in
+    add_int32 req (String.length name);
+    add_int32 req ((if List.mem Xolckrec xopts then 1 else 0) lor (if List.mem Xolckglb xopts then 2 else 0));
+    add_int32 req (String.length key);
+    add_int32 req (String.length value);
+    Buffer.add_string req name;
+    Buffer.add_string req key;
+    Buffer.add_string req value;
+    call t "ext" req (fun ic -> expect Emisc "ext" ic (fun () -> read_sized ic))
+
+  (*
+    works on any database type: keeps depth misc "iternext" requests in
+    flight on the first connection, so at most depth records are
+    buffered at once. ttserver answers a failed misc with code 1, which
+    past the last record means the end; a record arriving after that
+    shows it was an error instead, as does any other code.
+  *)
+  let fold t ?(depth = 64) f a =
+    if depth <= 0 then invalid_arg "fold";
+    let next () =
+      call t ~conn:0 "fold" (misc_req [] "iternext" []) (fun ic ->
+        read_code ic >>= function
+          | 0 ->
+              begin read_list ic >>= function
+                | [k; v] -> return (Some (k, v))
+                | _ -> error Emisc "fold"
+              end
+          | 1 -> return None
+          | _ -> error Emisc "fold") in
+    call t ~conn:0 "fold" (misc_req [] "iterinit" []) (fun ic -> expect Emisc "fold" ic (fun () -> read_list ic)) >>= fun _ ->
+    let q = Queue.create () in
+    for i = 1 to depth do Queue.add (next ()) q done;
+    let rec loop a =
+      if Queue.is_empty q then return a
+      else
+        Queue.pop q >>= function
+          | Some (k, v) -> Queue.add (next ()) q; loop (f k v a)
+          | None -> drain a
+    and drain a =
+      if Queue.is_empty q then return a
+      else
+        Queue.pop q >>= function
+          | Some _ -> error Emisc "fold"
+          | None -> drain a in
+    loop a
+
+  (*
+    misc name per chunk of about chunk_size bytes of items, with up to
+    window chunks in flight; failed chunks are returned as (index of
+    first item, items, exception).
+  *)
+  let misc_batch t ?(mopts = []) ?(chunk_size = 1048576) ?(window = 4) func name args_of bytes items read =
+    if chunk_size <= 0 || window <= 0 then invalid_arg func;
+    let inflight = Queue.create () in
+    let failed = ref [] in
+    let await () =
+      let start, n, r = Queue.pop inflight in
+      catch
+        (fun () -> r >>= fun l -> read l; return ())
+        (fun e -> failed := (start, n, e) :: !failed; return ()) in
+    let rec loop = function
+      | [] -> drain ()
+      | (start, chunk) :: chunks ->
+          (if Queue.length inflight >= window then await () else return ()) >>= fun () ->
+          let r =
+            call t func (misc_req mopts name (args_of chunk)) (fun ic ->
+              expect Emisc func ic (fun () -> read_list ic)) in
+          Queue.add (start, List.length chunk, r) inflight;
+          loop chunks
+    and drain () =
+      if Queue.is_empty inflight then return (List.rev !failed)
+      else await () >>= drain in
+    loop (Tokyo_tyrant.batch_chunks chunk_size bytes items)
+
+  let fwmkeys t ?(max = -1) prefix =
+    let req = request 0x58 in
+    add_int32 req (String.length prefix);
+    add_int32 req max;
+    Buffer.add_string req prefix;
+    call t "fwmkeys" req (fun ic -> expect Emisc "fwmkeys" ic (fun () -> read_list ic))
+
+  let key_req cmd key =
+    let req = request cmd in
+    add_int32 req (String.length key);
+    Buffer.add_string req key;
+    req
+
+  let get t key = call t "get" (key_req 0x30 key) (fun ic -> expect Enorec "get" ic (fun () -> read_sized ic))
+
+  let get_batch t ?chunk_size ?window keys =
+    let pairs = ref [] in
+    let rec add = function
+      | k :: v :: l -> pairs := (k, v) :: !pairs; add l
+      | _ -> () in
+    misc_batch t ?chunk_size ?window "get_batch" "getlist" (fun keys -> keys) String.length keys add >>= fun failed ->
+    return (List.rev !pairs, failed)
+
+  let get_into t key buf =
+    get t key >>= fun v ->
+    let len = String.length v in
+    for i = 0 to min len (Bigarray.Array1.dim buf) - 1 do
+      Bigarray.Array1.unsafe_set buf i (String.unsafe_get v i)
+    done;
+    return len
+
+  let mget t keys =
+    let req = request 0x31 in
+    add_int32 req (List.length keys);
+    List.iter (fun k -> add_int32 req (String.length k); Buffer.add_string req k) keys;
+    call t "mget" req (fun ic ->
+      expect Emisc "mget" ic (fun () ->
+        read_int32 ic >>= fun n ->
+        let rec loop acc n =
+          if n = 0 then return (List.rev acc)
+          else
+            read_int32 ic >>= fun ksiz ->
+            read_int32 ic >>= fun vsiz ->
+            read_string ic ksiz >>= fun k ->
+            read_string ic vsiz >>= fun v ->
+            loop ((k, v) :: acc) (n - 1) in
+        loop [] n))
+
+  let iter t ?depth f = fold t ?depth (fun k v () -> f k v) ()
+
+  let iterinit t = call t ~conn:0 "iterinit" (request 0x50) (fun ic -> expect Emisc "iterinit" ic return)
+
+  let iternext t = call t ~conn:0 "iternext" (request 0x51) (fun ic -> expect Enorec "iternext" ic (fun () -> read_sized ic))
+
+  let misc t ?(mopts = []) name args =
+    call t "misc" (misc_req mopts name args) (fun ic -> expect Emisc "misc" ic (fun () -> read_list ic))
+
+  let open_ t ?(conns = 1) host port =
+    if conns <= 0 then invalid_arg "open_";
+    begin
+      if port <= 0 then return (Unix.ADDR_UNIX host)
+      else
+        catch
+          (fun () ->
+             Lwt_unix.gethostbyname host >>= fun h ->
+             if Array.length h.Unix.h_addr_list = 0 then error Enohost "open"
+             else return (Unix.ADDR_INET (h.Unix.h_addr_list.(0), port)))
+          (function
+             | Error _ as e -> fail e
+             | _ -> error Enohost "open")
+    end >>= fun addr ->
+    let cs = Array.init conns (fun _ -> { chans = Some (connect addr); written = return (); read = return () }) in
+    catch
+      (fun () ->
+         Lwt_list.iter_p
+           (fun c -> match c.chans with Some p -> p >>= fun _ -> return () | None -> return ())
+           (Array.to_list cs) >>= fun () ->
+         t.addr <- Some addr;
+         t.conns <- cs;
+         t.next <- 0;
+         return ())
+      (fun e ->
+         Array.iter (fun c -> match c.chans with Some p -> break c p | None -> ()) cs;
+         fail e)
+
+  let optimize t ?(params = "") () =
+    let req = request 0x71 in
+    add_int32 req (String.length params);
+    Buffer.add_string req params;
+    unit_call t "optimize" req
+
+  let out t key = call t "out" (key_req 0x20 key) (fun ic -> expect Enorec "out" ic return)
+
+  let put_req cmd key value =
+    let req = request cmd in
+    add_int32 req (String.length key);
+    add_int32 req (String.length value);
+    Buffer.add_string req key;
+    Buffer.add_string req value;
+    req
+
+  let out_batch t ?mopts ?chunk_size ?window keys =
+    misc_batch t ?mopts ?chunk_size ?window "out_batch" "outlist" (fun keys -> keys) String.length keys ignore
+
+  let put t key value = unit_call t "put" (put_req 0x10 key value)
+
+  let put_ba t key buf off len =
+    Cstr.check_buf buf off len "put_ba";
+    put t key (string_of_buf buf off len)
+
+  let put_batch t ?mopts ?chunk_size ?window pairs =
+    misc_batch t ?mopts ?chunk_size ?window "put_batch" "putlist"
+      (fun pairs -> List.concat (List.map (fun (k, v) -> [k; v]) pairs))
+      (fun (k, v) -> String.length k + String.length v)
+      pairs ignore
+
+  let putcat t key value = unit_call t "putcat" (put_req 0x12 key value)
+
+  let putcat_ba t key buf off len =
+    Cstr.check_buf buf off len "putcat_ba";
+    putcat t key (string_of_buf buf off len)
+
+  let putkeep t key value = call t "putkeep" (put_req 0x11 key value) (fun ic -> expect Ekeep "putkeep" ic return)
+
+  let putkeep_ba t key buf off len =
+    Cstr.check_buf buf off len "putkeep_ba";
+    putkeep t key (string_of_buf buf off len)
+
+  let putnr t key value = send t "putnr" (put_req 0x18 key value)
+
+  let putshl t ?(width = 0) key value =
+    let req = request 0x13 in
+    add_int32 req (String.length key);
+    add_int32 req (String.length value);
+    add_int32 req width;
+    Buffer.add_string req key;
+    Buffer.add_string req value;
+    unit_call t "putshl" req
+
+  let rnum t = call t "rnum" (request 0x80) (fun ic -> expect Emisc "rnum" ic (fun () -> Lwt_io.BE.read_int64 ic))
+  let size t = call t "size" (request 0x81) (fun ic -> expect Emisc "size" ic (fun () -> Lwt_io.BE.read_int64 ic))
+  let stat t = call t "stat" (request 0x88) (fun ic -> expect Emisc "stat" ic (fun () -> read_sized ic))
+  let sync t = unit_call t "sync" (request 0x70)
+
+  let tune t ?(timeout = 0.) ?(topts = []) () =
+    t.timeout <- timeout;
+    t.recon <- List.mem Trecon topts
+
+  let vanish t = unit_call t "vanish" (request 0x72)
+
+  let vsiz t key = call t "vsiz" (key_req 0x38 key) (fun ic -> expect Enorec "vsiz" ic (fun () -> read_int32 ic))
+end
@@ -0,0 +1,69 @@
+(*
+  Tokyo Tyrant client speaking the binary protocol over Lwt_unix
+  sockets, without the C library. requests are pipelined: many may be
+  outstanding on one connection, and responses are matched up in order.
+*)
+
+open Tokyo_common
+open Tokyo_tyrant
+
+module RDB :
+sig
+  type t
+
+  module type Sig =
+  sig
+    type cstr_t
+    type tclist_t
+
+    val new_ : unit -> t
+
+    val adddouble : t -> cstr_t -> float -> float Lwt.t
+    val addint : t -> cstr_t -> int -> int Lwt.t
+    val close : t -> unit Lwt.t
+    val copy : t -> string -> unit Lwt.t
+    val ext : t -> ?xopts:xopt list -> string -> cstr_t -> cstr_t -> cstr_t Lwt.t
+    val fold : t -> ?depth:int -> (cstr_t -> cstr_t -> 'a -> 'a) -> 'a -> 'a Lwt.t
+    val fwmkeys : t -> ?max:int -> cstr_t -> tclist_t Lwt.t
+    val get : t -> cstr_t -> cstr_t Lwt.t
+    val get_batch : t -> ?chunk_size:int -> ?window:int -> cstr_t list -> ((cstr_t * cstr_t) list * (int * int * exn) list) Lwt.t
+    val get_into : t -> cstr_t -> Cstr.buf -> int Lwt.t
+    val mget : t -> cstr_t list -> (cstr_t * cstr_t) list Lwt.t
+    val iter : t -> ?depth:int -> (cstr_t -> cstr_t -> unit) -> unit Lwt.t
+    val iterinit : t -> unit Lwt.t
+    val iternext : t -> cstr_t Lwt.t
+    val misc : t -> ?mopts:mopt list -> string -> tclist_t -> tclist_t Lwt.t
+    val open_ : t -> ?conns:int -> string -> int -> unit Lwt.t
+    val optimize : t -> ?params:string -> unit -> unit Lwt.t
+    val out : t -> cstr_t -> unit Lwt.t
+    val out_batch : t -> ?mopts:mopt list -> ?chunk_size:int -> ?window:int -> cstr_t list -> (int * int * exn) list Lwt.t
+    val put : t -> cstr_t -> cstr_t -> unit Lwt.t
+    val put_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit Lwt.t
+    val put_batch :
+      t -> ?mopts:mopt list -> ?chunk_size:int -> ?window:int ->
+      (cstr_t * cstr_t) list -> (int * int * exn) list Lwt.t
+    val putcat : t -> cstr_t -> cstr_t -> unit Lwt.t
+    val putcat_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit Lwt.t
+    val putkeep : t -> cstr_t -> cstr_t -> unit Lwt.t
+    val putkeep_ba : t -> cstr_t -> Cstr.buf -> int -> int -> unit Lwt.t
+    val putnr : t -> cstr_t -> cstr_t -> unit Lwt.t
+    val putshl : t -> ?width:int -> cstr_t -> cstr_t -> unit Lwt.t
+    val rnum : t -> int64 Lwt.t
+    val size : t -> int64 Lwt.t
+    val stat : t -> string Lwt.t
+    val sync : t -> unit Lwt.t
+    val tune : t -> ?timeout:float -> ?topts:topt list -> unit -> unit
+    val vanish : t -> unit Lwt.t
+    val vsiz : t -> cstr_t -> int Lwt.t
+  end
+
+  (*
+    open_ makes conns connections (default 1); requests are spread
+    over them round-robin, except iterinit, iternext and fold, which
+    always use the first (the iterator is per connection). fold keeps
+    depth (default 64) requests in flight, and the _batch calls up to
+    window (default 4) chunks. a port of 0 or less opens
+    the UNIX socket at host.
+  *)
+  include Sig with type cstr_t = string and type tclist_t = string list
+end
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
 
@@ -7,6 +8,7 @@
 #include <caml/fail.h>
 #include <caml/memory.h>
 #include <caml/signals.h>
+#include <caml/bigarray.h>
 
 #include <tcrdb.h>
 
@@ -20,6 +22,47 @@
 #define double_option(v) ((v == Val_int(0)) ? 0 : Double_val(Field(v, 0)))
 #define bool_option(v) ((v == Val_int(0)) ? false : Bool_val(Field(v, 0)))
 
+/*
+  OCaml values may move once the runtime lock is released, so
+  arguments used inside a blocking section are copied out first.
+  Short ones (the common case for keys) go on the stack.
+*/
+#define SCRATCH_SIZ 256
+
+typedef struct scratch {
+  char *ptr;
+  char buf[SCRATCH_SIZ];
+} scratch;
+
+static void scratch_copy(scratch *s, value vstr, int len)
+{
+  s->ptr = (len <= SCRATCH_SIZ) ? s->buf : tcmalloc(len);
+  memcpy(s->ptr, String_val(vstr), len);
+}
+
+/* includes the trailing NUL */
+static void scratch_copy_string(scratch *s, value vstr)
+{
+  scratch_copy(s, vstr, caml_string_length(vstr) + 1);
+}
+
+static void scratch_copy_option(scratch *s, value vopt, int len)
+{
+  if (vopt == Val_int(0)) s->ptr = NULL;
+  else scratch_copy(s, Field(vopt, 0), len);
+}
+
+static void scratch_copy_string_option(scratch *s, value vopt)
+{
+  if (vopt == Val_int(0)) s->ptr = NULL;
+  else scratch_copy_string(s, Field(vopt, 0));
+}
+
+static void scratch_free(scratch *s)
+{
+  if (s->ptr && s->ptr != s->buf) tcfree(s->ptr);
+}
+
 
 
 enum error {
@@ -76,6 +119,25 @@ static value make_cstr(const void *string, int len)
   return vpair;
 }
 
+/* bufs/sizs hold n key/value pairs, interleaved */
+static value make_cstr_pairs(int n, void **bufs, int *sizs)
+{
+  CAMLparam0();
+  CAMLlocal4(vrecs, vkey, vval, vpair);
+  int i;
+  if (n == 0) CAMLreturn(Atom(0));
+  vrecs = caml_alloc(n, 0);
+  for (i = 0; i < n; i++) {
+    vkey = make_cstr(bufs[2 * i], sizs[2 * i]);
+    vval = make_cstr(bufs[2 * i + 1], sizs[2 * i + 1]);
+    vpair = caml_alloc_tuple(2);
+    Store_field(vpair, 0, vkey);
+    Store_field(vpair, 1, vval);
+    Store_field(vrecs, i, vpair);
+  }
+  CAMLreturn(vrecs);
+}
+
 
 
 typedef struct rdb_wrap {
@@ -116,9 +178,13 @@ value otoky_rdb_adddouble(value vrdb, value vkey, value vlen, value vnum)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   double num;
+  double inc = Double_val(vnum);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tcrdbadddouble(rdbw->rdb, String_val(vkey), Int_val(vlen), Double_val(vnum));
+  num = tcrdbadddouble(rdbw->rdb, keybuf.ptr, Int_val(vlen), inc);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (isnan(num)) rdb_error(rdbw, "adddouble");
   return caml_copy_double (num);
 }
@@ -128,9 +194,12 @@ value otoky_rdb_addint(value vrdb, value vkey, value vlen, value vnum)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   int num;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  num = tcrdbaddint(rdbw->rdb, String_val(vkey), Int_val(vlen), Int_val(vnum));
+  num = tcrdbaddint(rdbw->rdb, keybuf.ptr, Int_val(vlen), Int_val(vnum));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (num == INT_MIN) rdb_error(rdbw, "addint");
   return Val_int (num);
 }
@@ -152,21 +221,73 @@ value otoky_rdb_copy(value vrdb, value vpath)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  scratch pathbuf;
+  scratch_copy_string(&pathbuf, vpath);
   caml_enter_blocking_section();
-  r = tcrdbcopy(rdbw->rdb, String_val(vpath));
+  r = tcrdbcopy(rdbw->rdb, pathbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&pathbuf);
   if (!r) rdb_error(rdbw, "copy");
   return Val_unit;
 }
 
+enum xopt { Xolckrec, Xolckglb };
+
+static int xopts_int_of_list(value v)
+{
+  if (v == Val_int(0))
+    return 0;
+  else {
+    int xopts = 0;
+    for (v = Field(v, 0); v != Val_int(0); v = Field(v, 1)) {
+      switch (Int_val(Field(v, 0))) {
+      case Xolckrec: xopts |= RDBXOLCKREC; break;
+      case Xolckglb: xopts |= RDBXOLCKGLB; break;
+      }
+    }
+    return xopts;
+  }
+}
+
+CAMLprim
+value otoky_rdb_ext(value vrdb, value vxopts, value vname, value vkey, value vkeylen, value vval, value vvallen)
+{
+  rdb_wrap *rdbw = rdb_wrap_val(vrdb);
+  int xopts = xopts_int_of_list(vxopts);
+  void *r;
+  int len;
+  scratch namebuf, keybuf, valbuf;
+  scratch_copy_string(&namebuf, vname);
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
+  caml_enter_blocking_section();
+  r = tcrdbext(rdbw->rdb, namebuf.ptr, xopts, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen), &len);
+  caml_leave_blocking_section();
+  scratch_free(&namebuf);
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
+  if (!r) rdb_error(rdbw, "ext");
+  return make_cstr(r, len);
+}
+
+CAMLprim
+value otoky_rdb_ext_bc(value *argv, int argn)
+{
+  return otoky_rdb_ext(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6]);
+}
+
 CAMLprim
 TCLIST *otoky_rdb_fwmkeys(value vrdb, value vmax, value vprefix, value vlen)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   TCLIST *tclist;
+  int max = int_option(vmax);
+  scratch prefixbuf;
+  scratch_copy(&prefixbuf, vprefix, Int_val(vlen));
   caml_enter_blocking_section();
-  tclist = tcrdbfwmkeys(rdbw->rdb, String_val(vprefix), Int_val(vlen), int_option(vmax));
+  tclist = tcrdbfwmkeys(rdbw->rdb, prefixbuf.ptr, Int_val(vlen), max);
   caml_leave_blocking_section();
+  scratch_free(&prefixbuf);
   if (!tclist) rdb_error(rdbw, "fwmkeys");
   return tclist;
 }
@@ -177,13 +298,53 @@ value otoky_rdb_get(value vrdb, value vkey, value vlen)
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   void *val;
   int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  val = tcrdbget(rdbw->rdb, String_val(vkey), Int_val(vlen), &len);
+  val = tcrdbget(rdbw->rdb, keybuf.ptr, Int_val(vlen), &len);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!val) rdb_error(rdbw, "get");
   return make_cstr(val, len);
 }
 
+CAMLprim
+value otoky_rdb_get_into(value vrdb, value vkey, value vlen, value vbuf)
+{
+  CAMLparam1(vbuf);
+  rdb_wrap *rdbw = rdb_wrap_val(vrdb);
+  char *buf = Caml_ba_data_val(vbuf);
+  intnat dim = Caml_ba_array_val(vbuf)->dim[0];
+  int max = (dim > INT_MAX) ? INT_MAX : (int)dim;
+  void *val;
+  int len;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
+  caml_enter_blocking_section();
+  val = tcrdbget(rdbw->rdb, keybuf.ptr, Int_val(vlen), &len);
+  if (val) {
+    memcpy(buf, val, (len < max) ? len : max);
+    tcfree(val);
+  }
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!val) rdb_error(rdbw, "get_into");
+  CAMLreturn(Val_int(len));
+}
+
+/* tcrdbget3 replaces each key's value in place and drops keys not found */
+CAMLprim
+value otoky_rdb_mget(value vrdb, TCMAP *tcmap)
+{
+  rdb_wrap *rdbw = rdb_wrap_val(vrdb);
+  bool r;
+  caml_enter_blocking_section();
+  r = tcrdbget3(rdbw->rdb, tcmap);
+  caml_leave_blocking_section();
+  if (!r) rdb_error(rdbw, "mget");
+  return Val_unit;
+}
+
 CAMLprim
 value otoky_rdb_iterinit(value vrdb)
 {
@@ -231,9 +392,13 @@ TCLIST *otoky_rdb_misc(value vrdb, value vmopts, value vname, TCLIST *args)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   TCLIST *r;
+  int mopts = mopts_int_of_list(vmopts);
+  scratch namebuf;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tcrdbmisc(rdbw->rdb, String_val(vname), mopts_int_of_list(vmopts), args);
+  r = tcrdbmisc(rdbw->rdb, namebuf.ptr, mopts, args);
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) rdb_error(rdbw, "misc");
   return r;
 }
@@ -243,9 +408,12 @@ value otoky_rdb_open(value vrdb, value vname, value vport)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  scratch namebuf;
+  scratch_copy_string(&namebuf, vname);
   caml_enter_blocking_section();
-  r = tcrdbopen(rdbw->rdb, String_val(vname), Int_val(vport));
+  r = tcrdbopen(rdbw->rdb, namebuf.ptr, Int_val(vport));
   caml_leave_blocking_section();
+  scratch_free(&namebuf);
   if (!r) rdb_error(rdbw, "open");
   return Val_unit;
 }
@@ -255,9 +423,12 @@ value otoky_rdb_optimize(value vrdb, value vparams, value vunit)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  scratch paramsbuf;
+  scratch_copy_string_option(&paramsbuf, vparams);
   caml_enter_blocking_section();
-  r = tcrdboptimize(rdbw->rdb, string_option(vparams));
+  r = tcrdboptimize(rdbw->rdb, paramsbuf.ptr);
   caml_leave_blocking_section();
+  scratch_free(&paramsbuf);
   if (!r) rdb_error(rdbw, "optimize");
   return Val_unit;
 }
@@ -267,9 +438,12 @@ value otoky_rdb_out(value vrdb, value vkey, value vlen)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vlen));
   caml_enter_blocking_section();
-  r = tcrdbout(rdbw->rdb, String_val(vkey), Int_val(vlen));
+  r = tcrdbout(rdbw->rdb, keybuf.ptr, Int_val(vlen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (!r) rdb_error(rdbw, "out");
   return Val_unit;
 }
@@ -279,45 +453,134 @@ value otoky_rdb_put(value vrdb, value vkey, value vkeylen, value vval, value vva
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcrdbput(rdbw->rdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcrdbput(rdbw->rdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) rdb_error(rdbw, "put");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_rdb_put_ba(value vrdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  rdb_wrap *rdbw = rdb_wrap_val(vrdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tcrdbput(rdbw->rdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) rdb_error(rdbw, "put_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_rdb_put_ba_bc(value *argv, int argn)
+{
+  return otoky_rdb_put_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_rdb_putcat(value vrdb, value vkey, value vkeylen, value vval, value vvallen)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcrdbputcat(rdbw->rdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcrdbputcat(rdbw->rdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) rdb_error(rdbw, "putcat");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_rdb_putcat_ba(value vrdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  rdb_wrap *rdbw = rdb_wrap_val(vrdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tcrdbputcat(rdbw->rdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) rdb_error(rdbw, "putcat_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_rdb_putcat_ba_bc(value *argv, int argn)
+{
+  return otoky_rdb_putcat_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_rdb_putkeep(value vrdb, value vkey, value vkeylen, value vval, value vvallen)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcrdbputkeep(rdbw->rdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcrdbputkeep(rdbw->rdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) rdb_error(rdbw, "putkeep");
   return Val_unit;
 }
 
+CAMLprim
+value otoky_rdb_putkeep_ba(value vrdb, value vkey, value vkeylen, value vbuf, value voff, value vlen)
+{
+  CAMLparam1(vbuf);
+  rdb_wrap *rdbw = rdb_wrap_val(vrdb);
+  bool r;
+  char *val = (char *)Caml_ba_data_val(vbuf) + Int_val(voff);
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  caml_enter_blocking_section();
+  r = tcrdbputkeep(rdbw->rdb, keybuf.ptr, Int_val(vkeylen), val, Int_val(vlen));
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!r) rdb_error(rdbw, "putkeep_ba");
+  CAMLreturn(Val_unit);
+}
+
+CAMLprim
+value otoky_rdb_putkeep_ba_bc(value *argv, int argn)
+{
+  return otoky_rdb_putkeep_ba(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 CAMLprim
 value otoky_rdb_putnr(value vrdb, value vkey, value vkeylen, value vval, value vvallen)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcrdbputnr(rdbw->rdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen));
+  r = tcrdbputnr(rdbw->rdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) rdb_error(rdbw, "putnr");
   return Val_unit;
 }
@@ -327,9 +590,15 @@ value otoky_rdb_putshl(value vrdb, value vwidth, value vkey, value vkeylen, valu
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  int width = int_option0(vwidth);
+  scratch keybuf, valbuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
+  scratch_copy(&valbuf, vval, Int_val(vvallen));
   caml_enter_blocking_section();
-  r = tcrdbputshl(rdbw->rdb, String_val(vkey), Int_val(vkeylen), String_val(vval), Int_val(vvallen), int_option0(vwidth));
+  r = tcrdbputshl(rdbw->rdb, keybuf.ptr, Int_val(vkeylen), valbuf.ptr, Int_val(vvallen), width);
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  scratch_free(&valbuf);
   if (!r) rdb_error(rdbw, "putnr");
   return Val_unit;
 }
@@ -340,6 +609,66 @@ value otoky_rdb_putshl_bc(value *argv, int argn)
   return otoky_rdb_putshl(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
 }
 
+/*
+  one page of a scan, through misc "range" (so B+ tree databases only):
+  up to num records from bkey on, after dropping up to skip leading
+  records under bkey, so a scan can resume from the last key it saw
+  even when that key has duplicates.
+*/
+CAMLprim
+value otoky_rdb_range_pairs(value vrdb, value vbkey, value vblen, value vskip, value vnum)
+{
+  CAMLparam0();
+  CAMLlocal1(vrecs);
+  rdb_wrap *rdbw = rdb_wrap_val(vrdb);
+  int blen = Int_val(vblen);
+  intnat skip = Long_val(vskip);
+  intnat num = Long_val(vnum);
+  intnat want = (num > INT_MAX - skip) ? INT_MAX : num + skip;
+  TCLIST *args, *res;
+  char maxbuf[32];
+  void **bufs;
+  int *sizs;
+  int n, i, skipped = 0;
+  scratch keybuf;
+  scratch_copy(&keybuf, vbkey, blen);
+  sprintf(maxbuf, "%ld", (long)want);
+  caml_enter_blocking_section();
+  args = tclistnew2(2);
+  tclistpush(args, keybuf.ptr, blen);
+  tclistpush2(args, maxbuf);
+  res = tcrdbmisc(rdbw->rdb, "range", 0, args);
+  tclistdel(args);
+  /* the first skip records under bkey went out with earlier pages */
+  if (res) {
+    while (skipped < skip && 2 * skipped + 1 < tclistnum(res)) {
+      int len;
+      const char *key = tclistval(res, 2 * skipped, &len);
+      if (len != blen || memcmp(key, keybuf.ptr, len)) break;
+      skipped++;
+    }
+  }
+  caml_leave_blocking_section();
+  scratch_free(&keybuf);
+  if (!res) rdb_error(rdbw, "fold");
+  n = tclistnum(res) / 2 - skipped;
+  if (n > num) n = num;
+  if (n < 0) n = 0;
+  bufs = tcmalloc(2 * n * sizeof(void *) + 1);
+  sizs = tcmalloc(2 * n * sizeof(int) + 1);
+  for (i = 0; i < 2 * skipped; i++) {
+    int len;
+    tcfree(tclistshift(res, &len));
+  }
+  for (i = 0; i < 2 * n; i++)
+    bufs[i] = tclistshift(res, &sizs[i]);
+  tclistdel(res);
+  vrecs = make_cstr_pairs(n, bufs, sizs);
+  tcfree(bufs);
+  tcfree(sizs);
+  CAMLreturn(vrecs);
+}
+
 CAMLprim
 value otoky_rdb_rnum(value vrdb)
 {
@@ -410,8 +739,10 @@ value otoky_rdb_tune(value vrdb, value vtimeout, value vtopts, value vunit)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   bool r;
+  double timeout = double_option(vtimeout);
+  int topts = topts_int_of_list(vtopts);
   caml_enter_blocking_section();
-  r = tcrdbtune(rdbw->rdb, double_option(vtimeout), topts_int_of_list(vtopts));
+  r = tcrdbtune(rdbw->rdb, timeout, topts);
   caml_leave_blocking_section();
   if (!r) rdb_error(rdbw, "tune");
   return Val_unit;
@@ -434,9 +765,12 @@ value otoky_rdb_vsiz(value vrdb, value vkey, value vkeylen)
 {
   rdb_wrap *rdbw = rdb_wrap_val(vrdb);
   int r;
+  scratch keybuf;
+  scratch_copy(&keybuf, vkey, Int_val(vkeylen));
   caml_enter_blocking_section();
-  r = tcrdbvsiz(rdbw->rdb, String_val(vkey), Int_val(vkeylen));
+  r = tcrdbvsiz(rdbw->rdb, keybuf.ptr, Int_val(vkeylen));
   caml_leave_blocking_section();
+  scratch_free(&keybuf);
   if (r == -1) rdb_error(rdbw, "vsiz");
   return Val_int(r);
 }